@@ -0,0 +1,114 @@
+//------------------------------------------
+//--bump allocator for host graph and query arrays. Memory comes in chunks
+//--of anonymous mappings, 2 MB aligned and advised for transparent huge
+//--pages, so random adjacency accesses need fewer TLB entries. Allocations
+//--are page aligned (usable with CL_MEM_USE_HOST_PTR) and are not freed one
+//--by one: arenaRelease unmaps every chunk at once.
+//------------------------------------------
+#ifndef _ARENA_
+#define _ARENA_
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "util.h"
+
+#define ARENA_HUGE_PAGE (2 << 20)
+#define ARENA_CHUNK (64 << 20) // smallest chunk, larger requests get their own
+
+struct ArenaChunk
+{
+    char *base;
+    size_t size;
+    size_t used;
+};
+
+struct Arena
+{
+    std::vector<ArenaChunk> chunks;
+    bool populate = false; // fault allocations in up front
+};
+
+static size_t arenaRound(size_t size, size_t unit)
+{
+    return (size + unit - 1) / unit * unit;
+}
+
+//--prefault [p, p + size) after the huge page advice; MAP_POPULATE on the
+//--mmap would fault the chunk in before madvise and get small pages
+static void arenaPopulate(char *p, size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(p, size, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page)
+        p[offset] = 0;
+}
+
+static ArenaChunk *arenaGrow(Arena *arena, size_t bytes)
+{
+    ArenaChunk chunk;
+    chunk.size = arenaRound(std::max(bytes, (size_t)ARENA_CHUNK), ARENA_HUGE_PAGE);
+    chunk.used = 0;
+
+    //--over-map by one huge page and trim, so the chunk is 2 MB aligned
+    size_t mapped = chunk.size + ARENA_HUGE_PAGE;
+    char *p = (char *)mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw(std::string("arenaAlloc()::Error: Unable to map ") + std::to_string(chunk.size) + " bytes");
+
+    char *aligned = (char *)arenaRound((size_t)p, ARENA_HUGE_PAGE);
+    if (aligned > p)
+        munmap(p, aligned - p);
+    munmap(aligned + chunk.size, p + mapped - (aligned + chunk.size));
+    chunk.base = aligned;
+
+#ifdef MADV_HUGEPAGE
+    madvise(chunk.base, chunk.size, MADV_HUGEPAGE);
+#endif
+    arena->chunks.push_back(chunk);
+    return &arena->chunks.back();
+}
+
+//--n uninitialised elements, page aligned
+template <typename datatype>
+datatype *arenaAlloc(Arena *arena, size_t n)
+{
+    size_t bytes = arenaRound(n * sizeof(datatype) > 0 ? n * sizeof(datatype) : 1, 4096);
+
+    ArenaChunk *chunk = NULL;
+    for (size_t i = 0; i < arena->chunks.size() && !chunk; i++)
+        if (arena->chunks[i].size - arena->chunks[i].used >= bytes)
+            chunk = &arena->chunks[i];
+    if (!chunk)
+        chunk = arenaGrow(arena, bytes);
+
+    char *p = chunk->base + chunk->used;
+    chunk->used += bytes;
+    if (arena->populate)
+        arenaPopulate(p, bytes);
+    return (datatype *)p;
+}
+
+void arenaRelease(Arena *arena)
+{
+    for (size_t i = 0; i < arena->chunks.size(); i++)
+        munmap(arena->chunks[i].base, arena->chunks[i].size);
+    arena->chunks.clear();
+}
+
+//--from the arena if there is one, else malloc_aligned (release with free())
+template <typename datatype>
+datatype *hostAlloc(Arena *arena, size_t n)
+{
+    return arena ? arenaAlloc<datatype>(arena, n) : malloc_aligned<datatype>(n);
+}
+
+#endif //_ARENA_
@@ -0,0 +1,170 @@
+//------------------------------------------
+//--benchmark statistics for --bench: per-run samples of end-to-end, kernel
+//--and transfer time, summarised as min/median/p90/p99/mean/stddev
+//------------------------------------------
+#ifndef _BENCH_
+#define _BENCH_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "CLHelper.h"
+
+struct BenchRun
+{
+    double e2e_ms;      // host clock around the whole engine call
+    double kernel_ms;   // device time of the traversal kernels
+    double transfer_ms; // device time of H2D and D2H commands
+    long long edges;    // adjacency entries traversed: out-degree sum of reached
+                        // vertices, every undirected edge counted once per direction
+};
+
+struct BenchSummary
+{
+    double min, median, p90, p99, mean, stddev;
+};
+
+std::vector<BenchRun> bench_runs;
+
+//--monotonic clock in nanoseconds
+unsigned long long benchNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//--nearest-rank percentile of sorted samples
+static double benchPercentile(const std::vector<double> &sorted, double p)
+{
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+BenchSummary summarize(std::vector<double> samples)
+{
+    BenchSummary summary = {0, 0, 0, 0, 0, 0};
+    if (samples.empty())
+        return summary;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    summary.mean = sum / samples.size();
+
+    double squares = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+        squares += (samples[i] - summary.mean) * (samples[i] - summary.mean);
+    summary.stddev = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0;
+
+    summary.min = samples[0];
+    summary.median = samples.size() % 2 ? samples[samples.size() / 2]
+                                        : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+    summary.p90 = benchPercentile(samples, 90);
+    summary.p99 = benchPercentile(samples, 99);
+    return summary;
+}
+
+//--every engine gets its own label: bench.sh matches baseline rows on it
+static const char *engineName()
+{
+    switch (engine)
+    {
+    case ENGINE_MASK:
+        return "mask";
+    case ENGINE_QUEUE:
+        return "queue";
+    case ENGINE_ADAPTIVE:
+        return "adaptive";
+    case ENGINE_HYBRID:
+        return "hybrid";
+    case ENGINE_PARTITIONED:
+        return "partitioned";
+    case ENGINE_EXTERNAL:
+        return "external";
+    }
+    return "unknown";
+}
+
+static const char *memoryName()
+{
+    return memory_mode == MEMORY_ZEROCOPY ? "zerocopy" : memory_mode == MEMORY_AUTO ? "auto" : "copy";
+}
+
+static void writeBenchSummary(FILE *fp, const char *name, const BenchSummary &s)
+{
+    if (bench_format == BENCH_CSV)
+        fprintf(fp, ",%.6f,%.6f,%.6f,%.6f,%.6f,%.6f", s.min, s.median, s.p90, s.p99, s.mean, s.stddev);
+    else
+        fprintf(fp, ",\"%s\":{\"min\":%.6f,\"median\":%.6f,\"p90\":%.6f,\"p99\":%.6f,\"mean\":%.6f,\"stddev\":%.6f}",
+                name, s.min, s.median, s.p90, s.p99, s.mean, s.stddev);
+}
+
+//--write the statistics of bench_runs. CSV output gets a header when the
+//--file is new or empty, so runs of different configurations share one file.
+void writeBench(const std::string &graph, int no_of_nodes)
+{
+    if (bench_runs.empty())
+        return;
+
+    FILE *fp = bench_file.empty() ? stdout : fopen(bench_file.c_str(), "a");
+    if (!fp)
+        throw(std::string("writeBench()::Error: Unable to open ") + bench_file);
+
+    std::vector<double> e2e, kernel, transfer;
+    double harmonic = 0;
+    for (size_t i = 0; i < bench_runs.size(); i++)
+    {
+        e2e.push_back(bench_runs[i].e2e_ms);
+        kernel.push_back(bench_runs[i].kernel_ms);
+        transfer.push_back(bench_runs[i].transfer_ms);
+        if (bench_runs[i].edges > 0)
+            harmonic += bench_runs[i].e2e_ms * 1e6 / bench_runs[i].edges; // 1 / rate
+    }
+    BenchSummary e2e_summary = summarize(e2e);
+    //--rates are over adjacency entries, not input edges: about twice the
+    //--Graph500 TEPS of an undirected graph, hence the adjacency_ names
+    long long edges = bench_runs[0].edges;
+    double gteps = e2e_summary.median > 0 ? edges / (e2e_summary.median * 1e6) : 0;
+    double gteps_hmean = harmonic > 0 ? bench_runs.size() / harmonic : 0;
+
+    if (bench_format == BENCH_CSV)
+    {
+        if (fp == stdout || (fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == 0))
+        {
+            fprintf(fp, "graph,device,engine,work_group_size,memory,warmup,runs,nodes,adjacency_traversed");
+            const char *metrics[3] = {"e2e_ms", "kernel_ms", "transfer_ms"};
+            for (int m = 0; m < 3; m++)
+                fprintf(fp, ",%s_min,%s_median,%s_p90,%s_p99,%s_mean,%s_stddev",
+                        metrics[m], metrics[m], metrics[m], metrics[m], metrics[m], metrics[m]);
+            fprintf(fp, ",adjacency_gteps,adjacency_gteps_hmean\n");
+        }
+        fprintf(fp, "%s,%s,%s,%lu,%s,%d,%lu,%d,%lld", graph.c_str(), cpu ? "cpu" : "gpu", engineName(),
+                work_group_size, memoryName(), bench_warmup, bench_runs.size(), no_of_nodes, edges);
+    }
+    else
+    {
+        fprintf(fp, "{\"graph\":\"%s\",\"device\":\"%s\",\"engine\":\"%s\",\"work_group_size\":%lu,\"memory\":\"%s\","
+                    "\"warmup\":%d,\"runs\":%lu,\"nodes\":%d,\"adjacency_traversed\":%lld",
+                graph.c_str(), cpu ? "cpu" : "gpu", engineName(), work_group_size, memoryName(),
+                bench_warmup, bench_runs.size(), no_of_nodes, edges);
+    }
+    writeBenchSummary(fp, "e2e_ms", e2e_summary);
+    writeBenchSummary(fp, "kernel_ms", summarize(kernel));
+    writeBenchSummary(fp, "transfer_ms", summarize(transfer));
+    if (bench_format == BENCH_CSV)
+        fprintf(fp, ",%.6f,%.6f\n", gteps, gteps_hmean);
+    else
+        fprintf(fp, ",\"adjacency_gteps\":%.6f,\"adjacency_gteps_hmean\":%.6f}\n", gteps, gteps_hmean);
+
+    if (fp != stdout)
+        fclose(fp);
+    bench_runs.clear();
+}
+
+#endif //_BENCH_
@@ -0,0 +1,96 @@
+//------------------------------------------
+//--device buffers recycled across runs and engines (_clPoolAlloc and
+//--_clPoolFree in CLHelper.h). Requests are rounded up to a size class and
+//--freed buffers wait in their class for the next request of that class.
+//--Small state (flags, counters) is carved as sub-buffers out of slabs.
+//------------------------------------------
+#ifndef _BUFFER_POOL_
+#define _BUFFER_POOL_
+
+#include <CL/cl.h>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define POOL_MIN_CLASS 4096 // smallest class of a whole buffer
+#define POOL_SLAB_SLOTS 64  // sub-buffers carved from one slab
+
+struct PooledBuffer
+{
+    cl_mem_flags flags;
+    size_t size; // size class
+    bool slot;   // sub-buffer of a slab
+};
+
+struct BufferPool
+{
+    //--idle buffers by (flags, size class)
+    std::map<std::pair<cl_mem_flags, size_t>, std::vector<cl_mem>> idle;
+    //--every buffer the pool created, idle or handed out
+    std::unordered_map<cl_mem, PooledBuffer> owned;
+    std::vector<cl_mem> slabs;
+    size_t slot_size = 0; // sub-buffer size, the device's base address alignment
+
+    size_t used_bytes = 0;   // handed out, in size classes
+    size_t peak_bytes = 0;
+    size_t device_bytes = 0; // allocated from the device, slabs included
+    long long hits = 0, misses = 0;
+
+    BufferPool() = default;
+    BufferPool(BufferPool &&other) noexcept = default;
+    BufferPool &operator=(BufferPool &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            idle = std::move(other.idle);
+            owned = std::move(other.owned);
+            slabs = std::move(other.slabs);
+            slot_size = other.slot_size;
+            used_bytes = other.used_bytes;
+            peak_bytes = other.peak_bytes;
+            device_bytes = other.device_bytes;
+            hits = other.hits;
+            misses = other.misses;
+            other.owned.clear();
+            other.slabs.clear();
+        }
+        return *this;
+    }
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+    ~BufferPool() { clear(); }
+
+    //--release every buffer, handed out or not; sub-buffers before their slabs
+    void clear()
+    {
+        for (auto it = owned.begin(); it != owned.end(); ++it)
+            if (it->second.slot)
+                clReleaseMemObject(it->first);
+        for (auto it = owned.begin(); it != owned.end(); ++it)
+            if (!it->second.slot)
+                clReleaseMemObject(it->first);
+        for (size_t i = 0; i < slabs.size(); i++)
+            clReleaseMemObject(slabs[i]);
+        idle.clear();
+        owned.clear();
+        slabs.clear();
+        used_bytes = device_bytes = 0;
+    }
+};
+
+//--size class of a request: powers of two up to 8 * POOL_MIN_CLASS, then
+//--eighths of the power of two, so a class wastes at most 12.5%
+static size_t poolClass(size_t size)
+{
+    size_t pow2 = POOL_MIN_CLASS;
+    while (pow2 < size)
+        pow2 <<= 1;
+    if (pow2 <= 8 * POOL_MIN_CLASS)
+        return pow2;
+    size_t step = pow2 / 16;
+    return (size + step - 1) / step * step;
+}
+
+#endif //_BUFFER_POOL_
@@ -0,0 +1,74 @@
+//------------------------------------------
+//--move-only owners of OpenCL objects: the object is released when its
+//--handle goes out of scope or is given a new object. A handle converts to
+//--the raw cl_* type, so it can be passed straight to the OpenCL API.
+//------------------------------------------
+#ifndef _CL_HANDLE_
+#define _CL_HANDLE_
+
+#include <CL/cl.h>
+
+template <typename T, cl_int(CL_API_CALL *Release)(T)>
+class CLHandle
+{
+public:
+    CLHandle() : handle(NULL) {}
+    explicit CLHandle(T object) : handle(object) {}
+    ~CLHandle() { reset(); }
+
+    CLHandle(CLHandle &&other) noexcept : handle(other.handle) { other.handle = NULL; }
+    CLHandle &operator=(CLHandle &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            handle = other.handle;
+            other.handle = NULL;
+        }
+        return *this;
+    }
+    CLHandle(const CLHandle &) = delete;
+    CLHandle &operator=(const CLHandle &) = delete;
+
+    //--take ownership of a freshly created object
+    CLHandle &operator=(T object)
+    {
+        reset();
+        handle = object;
+        return *this;
+    }
+
+    operator T() const { return handle; }
+    T get() const { return handle; }
+
+    //--give up ownership without releasing
+    T release()
+    {
+        T object = handle;
+        handle = NULL;
+        return object;
+    }
+
+    //--release the object now; returns the status of the release call
+    cl_int reset()
+    {
+        cl_int status = CL_SUCCESS;
+        if (handle != NULL)
+            status = Release(handle);
+        handle = NULL;
+        return status;
+    }
+
+private:
+    T handle;
+};
+
+typedef CLHandle<cl_device_id, clReleaseDevice> CLDevice;
+typedef CLHandle<cl_context, clReleaseContext> CLContext;
+typedef CLHandle<cl_command_queue, clReleaseCommandQueue> CLQueue;
+typedef CLHandle<cl_program, clReleaseProgram> CLProgram;
+typedef CLHandle<cl_kernel, clReleaseKernel> CLKernel;
+typedef CLHandle<cl_mem, clReleaseMemObject> CLBuffer;
+typedef CLHandle<cl_event, clReleaseEvent> CLEvent;
+
+#endif //_CL_HANDLE_
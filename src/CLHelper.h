@@ -13,6 +13,12 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
+
+#include "BufferPool.h"
+#include "CLHandle.h"
+#include "Trace.h"
+#include "Graph.h"
 
 using std::cerr;
 using std::cout;
@@ -22,26 +28,176 @@ using std::string;
 //#pragma OPENCL EXTENSION cl_nv_compiler_options:enable
 #define WORK_DIM 2 //work-items dimensions
 
-struct oclHandleStruct
+// One device with its context, queues, program and kernels, set up by
+// _clInit(). Move-only; the OpenCL objects are released with it (members are
+// destroyed in reverse order, kernels first, context last).
+struct CLEnvironment
 {
-    cl_context context;
-    cl_device_id *devices;
-    cl_command_queue queue;
-    cl_program program;
+    CLDevice split_device;           // sub-device of a _clSplit environment
+    CLContext context;
+    std::vector<cl_device_id> devices;
+    int device_id;                   // index into devices
+    CLQueue queue;
+    CLQueue transfer_queue;          // second queue for uploads overlapping kernels
+    std::vector<CLDevice> node_devices; // one sub-device per NUMA node (--numa, CPU only)
+    std::vector<CLQueue> node_queues;
+    CLProgram program;
+    cl_bool host_unified_memory;
+    bool zero_copy;                  // resolved from memory_mode
+    cl_ulong max_alloc_size;         // CL_DEVICE_MAX_MEM_ALLOC_SIZE
     cl_int cl_status;
     std::string error_str;
-    std::vector<cl_kernel> kernel;
+    std::vector<CLKernel> kernel;
+    BufferPool pool;                 // device buffers of _clPoolAlloc
 };
 
-struct oclHandleStruct oclHandles;
+// The _cl* helpers work on the calling thread's current environment. The
+// main thread starts out with default_env; other threads bind their own
+// with CLBinding so engines can run side by side on different devices.
+CLEnvironment default_env;
+thread_local CLEnvironment *cl_env = &default_env;
+
+class CLBinding
+{
+public:
+    explicit CLBinding(CLEnvironment &env) : previous(cl_env) { cl_env = &env; }
+    ~CLBinding() { cl_env = previous; }
+    CLBinding(const CLBinding &) = delete;
+    CLBinding &operator=(const CLBinding &) = delete;
+
+private:
+    CLEnvironment *previous;
+};
 
 char kernel_file[100] = "Kernels.cl";
-int total_kernels = 1;
-string kernel_names[2] = {"BFS_1"};
-size_t work_group_size = 512;
+int total_kernels = 14;
+string kernel_names[14] = {"BFS_1", "BFS_QUEUE", "BFS_BITMAP", "QUEUE_TO_BITMAP", "MASK_TO_FLAGS", "SCAN_LOCAL", "SCAN_ADD", "COMPACT",
+                           "MSBFS_INIT", "MSBFS_EXPAND", "MSBFS_UPDATE", "PART_EXPAND", "PART_UPDATE", "BFS_COMPRESSED"};
+thread_local size_t work_group_size = 0; // 0: picked from the graph size in main
 int device_id_inuse = 0;
 bool cpu = false;
 
+// Indices into kernel_names/cl_env->kernel
+enum KernelId
+{
+    KERNEL_BFS_1,
+    KERNEL_BFS_QUEUE,
+    KERNEL_BFS_BITMAP,
+    KERNEL_QUEUE_TO_BITMAP,
+    KERNEL_MASK_TO_FLAGS,
+    KERNEL_SCAN_LOCAL,
+    KERNEL_SCAN_ADD,
+    KERNEL_COMPACT,
+    KERNEL_MSBFS_INIT,
+    KERNEL_MSBFS_EXPAND,
+    KERNEL_MSBFS_UPDATE,
+    KERNEL_PART_EXPAND,
+    KERNEL_PART_UPDATE,
+    KERNEL_BFS_COMPRESSED
+};
+
+// Traversal strategy used by the OpenCL device
+enum Engine
+{
+    ENGINE_MASK,        // BFS_1 over the dense char masks
+    ENGINE_QUEUE,       // BFS_QUEUE over a compact frontier queue
+    ENGINE_ADAPTIVE,    // switches between BFS_QUEUE and BFS_BITMAP per level
+    ENGINE_HYBRID,      // small levels on the host, large ones with BFS_QUEUE
+    ENGINE_PARTITIONED, // vertex ranges on several devices (--devices or --fission)
+    ENGINE_EXTERNAL     // host only, adjacency read through the mapped .csr file
+};
+Engine engine = ENGINE_MASK;
+
+// Adaptive engine: go dense once the frontier has more than
+// no_of_edges / to_dense_divisor outgoing edges, go back to a queue once it
+// has fewer than no_of_nodes / to_sparse_divisor vertices.
+int to_dense_divisor = 20;
+int to_sparse_divisor = 50;
+
+// Hybrid engine: move to the device once the frontier has more than
+// no_of_edges / to_device_divisor outgoing edges, back to the host below
+// no_of_edges / to_host_divisor
+int to_device_divisor = 100;
+int to_host_divisor = 400;
+
+// How graph and result buffers reach the device
+enum MemoryMode
+{
+    MEMORY_COPY,     // separate device buffers, explicit H2D/D2H copies
+    MEMORY_ZEROCOPY, // buffers alias host memory, accessed through map/unmap
+    MEMORY_AUTO      // zero-copy if the device shares memory with the host
+};
+MemoryMode memory_mode = MEMORY_COPY;
+
+// JSON lines file for per-level statistics ("-" for stdout), empty if off
+string level_trace_file;
+
+// Bytes per asynchronous edge upload chunk (--upload-chunk), 0 uploads the
+// edges in one go. Chunks let kernels read the edge buffer while later
+// chunks are still written into it; OpenCL 1.2 leaves that undefined, so it
+// is opt-in for implementations known to handle it.
+size_t upload_chunk_bytes = 0;
+
+// Delta+varint compressed adjacency (--compress, mask and external engines)
+bool compress_edges = false;
+
+// Vertex renumbering applied after the graph is built (--reorder)
+ReorderMode reorder_mode = REORDER_NONE;
+
+// .csr file the graph is written to after building and reordering (--save)
+string save_file;
+
+// Adjacency the semi-external engine reads ahead of the frontier (--prefetch)
+size_t prefetch_bytes = 16 << 20;
+
+// Out-of-core traversal (--shard): bytes of edges per streamed shard, 0 only
+// when the edge array exceeds the device's largest allocation
+size_t shard_bytes = 0;
+
+// Command timing: off, totals resolved once at the end of a run (queue keeps
+// running asynchronously), or per-command timing with a finish after each
+enum ProfileMode
+{
+    PROFILE_OFF,
+    PROFILE_SUMMARY,
+    PROFILE_FULL
+};
+#ifdef PROFILING
+thread_local ProfileMode profile_mode = PROFILE_FULL;
+#else
+thread_local ProfileMode profile_mode = PROFILE_OFF;
+#endif
+
+// Benchmark mode: untimed warmup runs, then statistics over the -i runs
+enum BenchFormat
+{
+    BENCH_OFF,
+    BENCH_CSV, // header and one row
+    BENCH_JSON // one object per line
+};
+BenchFormat bench_format = BENCH_OFF;
+int bench_warmup = 0;
+string bench_file; // appended to, stdout if empty
+
+// Hardware counters around host-side phases (PerfCounters.h)
+bool perf_counters = false;
+
+// Prefault the host arena's huge pages as arrays are allocated (Arena.h)
+bool arena_populate = false;
+
+// Place graph ranges on NUMA nodes, one CPU sub-device per node (Numa.h)
+bool numa_mode = false;
+
+// Devices of the partitioned engine (--devices), empty for all of them
+std::vector<int> partition_devices;
+
+// Device fission (--fission, CPU only): independent queries run side by side
+// on sub-devices of the device, this many, 0 for one per NUMA node, -1 off
+int fission_parts = -1;
+
+// Unix socket the query server listens on (Server.h), empty if not serving
+string serve_socket;
+
 /*
  * Converts the contents of a file into a string
  */
@@ -143,6 +299,36 @@ void _clCmdParams(int argc, char *argv[], int* source, int* iterations, bool* un
             printf("Attempting to use CPU instead of GPU.\n");
 #endif
             break;
+        case 'e': //--e stands for the traversal engine
+            if (++i < argc)
+            {
+                if (strcmp(argv[i], "mask") == 0)
+                    engine = ENGINE_MASK;
+                else if (strcmp(argv[i], "queue") == 0)
+                    engine = ENGINE_QUEUE;
+                else if (strcmp(argv[i], "adaptive") == 0)
+                    engine = ENGINE_ADAPTIVE;
+                else if (strcmp(argv[i], "hybrid") == 0)
+                    engine = ENGINE_HYBRID;
+                else if (strcmp(argv[i], "partitioned") == 0)
+                    engine = ENGINE_PARTITIONED;
+                else if (strcmp(argv[i], "external") == 0)
+                    engine = ENGINE_EXTERNAL;
+                else
+                {
+                    std::cerr << "Unknown engine " << argv[i] << std::endl;
+                    throw;
+                }
+#ifdef VERBOSE
+                printf("Setting engine to %s\n", argv[i]);
+#endif
+            }
+            else
+            {
+                std::cerr << "Could not read argument after option " << argv[i - 1] << std::endl;
+                throw;
+            }
+            break;
         case 'u':
             *undirected = true;
 #ifdef VERBOSE
@@ -177,180 +363,340 @@ void _clCmdParams(int argc, char *argv[], int* source, int* iterations, bool* un
                 throw;
             }
             break;
+        case '-': //--long options
+            if (strcmp(argv[i], "--to-dense") == 0 && i + 1 < argc)
+            {
+                sscanf(argv[++i], "%d", &to_dense_divisor);
+#ifdef VERBOSE
+                printf("Setting dense switch divisor to %d\n", to_dense_divisor);
+#endif
+            }
+            else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc)
+            {
+                i++;
+                if (strcmp(argv[i], "copy") == 0)
+                    memory_mode = MEMORY_COPY;
+                else if (strcmp(argv[i], "zerocopy") == 0)
+                    memory_mode = MEMORY_ZEROCOPY;
+                else if (strcmp(argv[i], "auto") == 0)
+                    memory_mode = MEMORY_AUTO;
+                else
+                {
+                    std::cerr << "Unknown memory mode " << argv[i] << std::endl;
+                    throw;
+                }
+#ifdef VERBOSE
+                printf("Setting memory mode to %s\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--upload-chunk") == 0 && i + 1 < argc)
+            {
+                int megabytes = 0;
+                sscanf(argv[++i], "%d", &megabytes);
+                if (megabytes < 0)
+                {
+                    std::cerr << "Negative upload chunk size " << argv[i] << std::endl;
+                    throw;
+                }
+                upload_chunk_bytes = (size_t)megabytes << 20;
+#ifdef VERBOSE
+                printf("Setting upload chunk size to %d MB\n", megabytes);
+#endif
+            }
+            else if (strcmp(argv[i], "--compress") == 0)
+            {
+                compress_edges = true;
+#ifdef VERBOSE
+                printf("Compressing adjacency lists\n");
+#endif
+            }
+            else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc)
+            {
+                i++;
+                if (strcmp(argv[i], "none") == 0)
+                    reorder_mode = REORDER_NONE;
+                else if (strcmp(argv[i], "degree") == 0)
+                    reorder_mode = REORDER_DEGREE;
+                else if (strcmp(argv[i], "rcm") == 0)
+                    reorder_mode = REORDER_RCM;
+                else if (strcmp(argv[i], "bfs") == 0)
+                    reorder_mode = REORDER_BFS;
+                else
+                {
+                    std::cerr << "Unknown reordering " << argv[i] << std::endl;
+                    throw;
+                }
+#ifdef VERBOSE
+                printf("Reordering vertices by %s\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            {
+                save_file = argv[++i];
+#ifdef VERBOSE
+                printf("Saving the graph to %s\n", save_file.c_str());
+#endif
+            }
+            else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc)
+            {
+                int megabytes = 0;
+                sscanf(argv[++i], "%d", &megabytes);
+                prefetch_bytes = (size_t)(megabytes > 0 ? megabytes : 1) << 20;
+#ifdef VERBOSE
+                printf("Prefetching %d MB of adjacency\n", megabytes);
+#endif
+            }
+            else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc)
+            {
+                int megabytes = 0;
+                sscanf(argv[++i], "%d", &megabytes);
+                if (megabytes < 0)
+                {
+                    std::cerr << "Negative shard size " << argv[i] << std::endl;
+                    throw;
+                }
+                shard_bytes = (size_t)megabytes << 20;
+#ifdef VERBOSE
+                printf("Streaming edges in shards of %d MB\n", megabytes);
+#endif
+            }
+            else if (strcmp(argv[i], "--level-trace") == 0 && i + 1 < argc)
+            {
+                level_trace_file = argv[++i];
+#ifdef VERBOSE
+                printf("Writing per-level statistics to %s\n", level_trace_file.c_str());
+#endif
+            }
+            else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            {
+                trace_file = argv[++i];
+                tracing = true;
+#ifdef VERBOSE
+                printf("Writing timeline to %s\n", trace_file.c_str());
+#endif
+            }
+            else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            {
+                i++;
+                if (strcmp(argv[i], "off") == 0)
+                    profile_mode = PROFILE_OFF;
+                else if (strcmp(argv[i], "summary") == 0)
+                    profile_mode = PROFILE_SUMMARY;
+                else if (strcmp(argv[i], "full") == 0)
+                    profile_mode = PROFILE_FULL;
+                else
+                {
+                    std::cerr << "Unknown profile mode " << argv[i] << std::endl;
+                    throw;
+                }
+#ifdef VERBOSE
+                printf("Setting profile mode to %s\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+            {
+                i++;
+                if (strcmp(argv[i], "csv") == 0)
+                    bench_format = BENCH_CSV;
+                else if (strcmp(argv[i], "json") == 0)
+                    bench_format = BENCH_JSON;
+                else
+                {
+                    std::cerr << "Unknown benchmark format " << argv[i] << std::endl;
+                    throw;
+                }
+#ifdef VERBOSE
+                printf("Writing benchmark statistics as %s\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            {
+                sscanf(argv[++i], "%d", &bench_warmup);
+#ifdef VERBOSE
+                printf("Setting warmup runs to %d\n", bench_warmup);
+#endif
+            }
+            else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc)
+            {
+                bench_file = argv[++i];
+#ifdef VERBOSE
+                printf("Appending benchmark statistics to %s\n", bench_file.c_str());
+#endif
+            }
+            else if (strcmp(argv[i], "--perf") == 0)
+            {
+                perf_counters = true;
+#ifdef VERBOSE
+                printf("Reading hardware performance counters\n");
+#endif
+            }
+            else if (strcmp(argv[i], "--numa") == 0)
+            {
+                numa_mode = true;
+#ifdef VERBOSE
+                printf("Placing the graph by NUMA node\n");
+#endif
+            }
+            else if (strcmp(argv[i], "--populate") == 0)
+            {
+                arena_populate = true;
+#ifdef VERBOSE
+                printf("Prefaulting host arrays\n");
+#endif
+            }
+            else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            {
+                serve_socket = argv[++i];
+#ifdef VERBOSE
+                printf("Serving queries on %s\n", serve_socket.c_str());
+#endif
+            }
+            else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc)
+            {
+                i++;
+                partition_devices.clear();
+                if (strcmp(argv[i], "all") != 0)
+                {
+                    //--comma separated ids
+                    for (char *p = argv[i]; *p;)
+                    {
+                        partition_devices.push_back(strtol(p, &p, 10));
+                        if (*p == ',')
+                            p++;
+                        else if (*p)
+                            throw(string("--devices takes all or a comma separated list of ids"));
+                    }
+                }
+#ifdef VERBOSE
+                printf("Partitioning over devices %s\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--fission") == 0 && i + 1 < argc)
+            {
+                i++;
+                fission_parts = strcmp(argv[i], "numa") == 0 ? 0 : atoi(argv[i]);
+                if (fission_parts < 0 || (fission_parts == 0 && strcmp(argv[i], "numa") != 0))
+                    throw(string("--fission takes a number of sub-devices or numa"));
+#ifdef VERBOSE
+                printf("Splitting the device into %s sub-devices\n", argv[i]);
+#endif
+            }
+            else if (strcmp(argv[i], "--to-device") == 0 && i + 1 < argc)
+            {
+                sscanf(argv[++i], "%d", &to_device_divisor);
+#ifdef VERBOSE
+                printf("Setting device switch divisor to %d\n", to_device_divisor);
+#endif
+            }
+            else if (strcmp(argv[i], "--to-host") == 0 && i + 1 < argc)
+            {
+                sscanf(argv[++i], "%d", &to_host_divisor);
+#ifdef VERBOSE
+                printf("Setting host switch divisor to %d\n", to_host_divisor);
+#endif
+            }
+            else if (strcmp(argv[i], "--to-sparse") == 0 && i + 1 < argc)
+            {
+                sscanf(argv[++i], "%d", &to_sparse_divisor);
+#ifdef VERBOSE
+                printf("Setting sparse switch divisor to %d\n", to_sparse_divisor);
+#endif
+            }
+            else
+            {
+                std::cerr << "Unknown option or missing argument: " << argv[i] << std::endl;
+                throw;
+            }
+            break;
         default:;
         }
     }
 }
 
 //---------------------------------------
-//Initlize CL objects
-//--description: there are 5 steps to initialize all the OpenCL objects needed
-//--revised on 04/01/2011: get the number of devices  and
-//  devices have no relationship with context
-void _clInit()
+//--queues, program and kernels for cl_env->devices[cl_env->device_id], whose
+//--context is already in cl_env (steps 4 and 5 of _clInit)
+void _clInitDevice(MemoryMode memory_mode)
 {
-    int DEVICE_ID_inuse = device_id_inuse;
     cl_int resultCL;
+    cl_device_id device = cl_env->devices[cl_env->device_id];
 
-    oclHandles.context = NULL;
-    oclHandles.devices = NULL;
-    oclHandles.queue = NULL;
-    oclHandles.program = NULL;
-
-    cl_uint deviceListSize;
-
-    //-----------------------------------------------
-    //--cambine-1: find the available platforms and select one
-
-    cl_uint numPlatforms;
-    cl_platform_id targetPlatform = NULL;
-
-    resultCL = clGetPlatformIDs(0, NULL, &numPlatforms);
+    char vendor[128];
+    resultCL = clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(vendor), vendor, NULL);
     if (resultCL != CL_SUCCESS)
-    {
-        throw(string("InitCL()::Error: Getting number of platforms (clGetPlatformIDs)"));
-    }
-
-#ifdef VERBOSE
-    printf("Number of platforms: %d\n", numPlatforms);
-#endif
-
-    if (!(numPlatforms > 0))
-    {
-        throw(string("InitCL()::Error: No platforms found (clGetPlatformIDs)"));
-    }
+        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo-2)"));
 
-    cl_platform_id *allPlatforms = (cl_platform_id *)malloc(numPlatforms * sizeof(cl_platform_id));
+    resultCL = clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_env->host_unified_memory), &cl_env->host_unified_memory, NULL);
 
-    resultCL = clGetPlatformIDs(numPlatforms, allPlatforms, NULL);
     if (resultCL != CL_SUCCESS)
-        throw(string("InitCL()::Error: Getting platform ids (clGetPlatformIDs)"));
+        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo-3)"));
 
-    /* Select the target platform. Default: first platform */
-    targetPlatform = allPlatforms[cpu ? 1 : 0];
-    for (int i = 0; i < numPlatforms; i++)
-    {
-        char pbuff[128];
-        resultCL = clGetPlatformInfo(allPlatforms[i],
-                                     CL_PLATFORM_VENDOR,
-                                     sizeof(pbuff),
-                                     pbuff,
-                                     NULL);
-        if (resultCL != CL_SUCCESS)
-            throw(string("InitCL()::Error: Getting platform info (clGetPlatformInfo)"));
+    cl_env->zero_copy = memory_mode == MEMORY_ZEROCOPY || (memory_mode == MEMORY_AUTO && cl_env->host_unified_memory);
 
-#ifdef VERBOSE
-        printf("Vendor of platform %d is %s\n", i, pbuff);
-#endif
-    }
+    resultCL = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_env->max_alloc_size), &cl_env->max_alloc_size, NULL);
+    if (resultCL != CL_SUCCESS)
+        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo-4)"));
 
 #ifdef VERBOSE
-    printf("Using platform %d.\n", cpu ? 1 : 0);
+    printf("Device %s host memory, using %s buffers\n", cl_env->host_unified_memory ? "shares" : "does not share", cl_env->zero_copy ? "zero-copy" : "copied");
 #endif
 
-    free(allPlatforms);
-
-    //-----------------------------------------------
-    //--cambine-2: create an OpenCL context
-    cl_context_properties cprops[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties)targetPlatform, 0};
-    oclHandles.context = clCreateContextFromType(cprops,
-                                                 cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU,
-                                                 NULL,
-                                                 NULL,
-                                                 &resultCL);
-
-    if ((resultCL != CL_SUCCESS) || (oclHandles.context == NULL))
-        throw(string("InitCL()::Error: Creating Context (clCreateContextFromType)"));
     //-----------------------------------------------
-    //--cambine-3: detect OpenCL devices
-    /* First, get the size of device list */
-    oclHandles.cl_status = clGetDeviceIDs(targetPlatform, cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU, 0, NULL, &deviceListSize);
-    if (oclHandles.cl_status != CL_SUCCESS)
-    {
-        throw(string("exception in _clInit -> clGetDeviceIDs"));
-    }
-    if (deviceListSize == 0)
-        throw(string("InitCL()::Error: No devices found."));
+    //--cambine-4: Create an OpenCL command queue
+    //--event timestamps only when profiling or tracing (--trace)
+    cl_command_queue_properties queue_properties = 0;
+    if (profile_mode != PROFILE_OFF || tracing)
+        queue_properties = CL_QUEUE_PROFILING_ENABLE;
+    cl_env->queue = clCreateCommandQueue(cl_env->context,
+                                            device,
+                                            queue_properties,
+                                            &resultCL);
 
-    //std::cout<<"device number:"<<deviceListSize<<std::endl;
+    if ((resultCL != CL_SUCCESS) || (cl_env->queue == NULL))
+        throw(string("InitCL()::Creating Command Queue. (clCreateCommandQueue)"));
 
-    /* Now, allocate the device list */
-    oclHandles.devices = (cl_device_id *)malloc(deviceListSize * sizeof(cl_device_id));
+    cl_env->transfer_queue = clCreateCommandQueue(cl_env->context,
+                                                     device,
+                                                     queue_properties,
+                                                     &resultCL);
 
-    if (oclHandles.devices == 0)
-        throw(string("InitCL()::Error: Could not allocate memory."));
+    if ((resultCL != CL_SUCCESS) || (cl_env->transfer_queue == NULL))
+        throw(string("InitCL()::Creating Transfer Command Queue. (clCreateCommandQueue)"));
 
-    /* Next, get the device list data */
-    oclHandles.cl_status = clGetDeviceIDs(targetPlatform, cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU, deviceListSize,
-                                          oclHandles.devices, NULL);
-    if (oclHandles.cl_status != CL_SUCCESS)
+    for (size_t i = 0; i < cl_env->node_devices.size(); i++)
     {
-        throw(string("exception in _clInit -> clGetDeviceIDs-2"));
+        cl_command_queue queue = clCreateCommandQueue(cl_env->context, cl_env->node_devices[i], queue_properties, &resultCL);
+        if ((resultCL != CL_SUCCESS) || (queue == NULL))
+            throw(string("InitCL()::Creating NUMA Command Queue. (clCreateCommandQueue)"));
+        cl_env->node_queues.push_back(CLQueue(queue));
     }
-
-    cl_bool result;
-    resultCL = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_AVAILABLE, sizeof(result), &result, NULL);
-
-    if (resultCL != CL_SUCCESS)
-        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo)"));
-
-    if (!result) {
-        throw(string("Device %d is not available.\n", DEVICE_ID_inuse));
-    }
-
-    char vendor[128];
-    resultCL = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_VENDOR, sizeof(vendor), vendor, NULL);
-
-    if (resultCL != CL_SUCCESS)
-        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo-2)"));
-
-#ifdef VERBOSE
-    printf("Vendor of selected device %d is %s\n", DEVICE_ID_inuse, vendor);
-#endif
-
-    //-----------------------------------------------
-    //--cambine-4: Create an OpenCL command queue
-    #ifdef PROFILING
-    oclHandles.queue = clCreateCommandQueue(oclHandles.context,
-                                            oclHandles.devices[DEVICE_ID_inuse],
-                                            CL_QUEUE_PROFILING_ENABLE,
-                                            &resultCL);
-    
-    #else
-    oclHandles.queue = clCreateCommandQueue(oclHandles.context,
-                                            oclHandles.devices[DEVICE_ID_inuse],
-                                            0,
-                                            &resultCL);
-    #endif
-
-    if ((resultCL != CL_SUCCESS) || (oclHandles.queue == NULL))
-        throw(string("InitCL()::Creating Command Queue. (clCreateCommandQueue)"));
     //-----------------------------------------------
     //--cambine-5: Load CL file, build CL program object, create CL kernel object
     std::string source_str = FileToString(kernel_file);
     const char *source = source_str.c_str();
     size_t sourceSize[] = {source_str.length()};
 
-    oclHandles.program = clCreateProgramWithSource(oclHandles.context,
+    cl_env->program = clCreateProgramWithSource(cl_env->context,
                                                    1,
                                                    &source,
                                                    sourceSize,
                                                    &resultCL);
 
-    if ((resultCL != CL_SUCCESS) || (oclHandles.program == NULL))
+    if ((resultCL != CL_SUCCESS) || (cl_env->program == NULL))
         throw(string("InitCL()::Error: Loading Binary into cl_program. (clCreateProgramWithBinary)"));
     //insert debug information
     //std::string options= "-cl-nv-verbose"; //Doesn't work on AMD machines
     //options += " -cl-nv-opt-level=3";
-    resultCL = clBuildProgram(oclHandles.program, deviceListSize, oclHandles.devices, NULL, NULL, NULL);
+    //--for every device of the context (sub-devices included)
+    resultCL = clBuildProgram(cl_env->program, 0, NULL, NULL, NULL, NULL);
 
-    if ((resultCL != CL_SUCCESS) || (oclHandles.program == NULL))
+    if ((resultCL != CL_SUCCESS) || (cl_env->program == NULL))
     {
         cerr << "InitCL()::Error: In clBuildProgram" << endl;
 
         size_t length;
-        resultCL = clGetProgramBuildInfo(oclHandles.program,
-                                         oclHandles.devices[DEVICE_ID_inuse],
+        resultCL = clGetProgramBuildInfo(cl_env->program,
+                                         device,
                                          CL_PROGRAM_BUILD_LOG,
                                          0,
                                          NULL,
@@ -359,8 +705,8 @@ void _clInit()
             throw(string("InitCL()::Error: Getting Program build info(clGetProgramBuildInfo)"));
 
         char *buffer = (char *)malloc(length);
-        resultCL = clGetProgramBuildInfo(oclHandles.program,
-                                         oclHandles.devices[DEVICE_ID_inuse],
+        resultCL = clGetProgramBuildInfo(cl_env->program,
+                                         device,
                                          CL_PROGRAM_BUILD_LOG,
                                          length,
                                          buffer,
@@ -376,25 +722,31 @@ void _clInit()
 
 //get program information in intermediate representation
 #ifdef PTX_MSG
-    size_t binary_sizes[deviceListSize];
-    char *binaries[deviceListSize];
+    cl_uint program_devices;
+    cl_env->cl_status = clGetProgramInfo(cl_env->program, CL_PROGRAM_NUM_DEVICES, sizeof(program_devices), &program_devices, NULL);
+    if (cl_env->cl_status != CL_SUCCESS)
+    {
+        throw(string("--cambine:exception in _InitCL -> clGetProgramInfo-1"));
+    }
+    size_t binary_sizes[program_devices];
+    char *binaries[program_devices];
     //figure out number of devices and the sizes of the binary for each device.
-    oclHandles.cl_status = clGetProgramInfo(oclHandles.program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * deviceListSize, &binary_sizes, NULL);
-    if (oclHandles.cl_status != CL_SUCCESS)
+    cl_env->cl_status = clGetProgramInfo(cl_env->program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * program_devices, &binary_sizes, NULL);
+    if (cl_env->cl_status != CL_SUCCESS)
     {
         throw(string("--cambine:exception in _InitCL -> clGetProgramInfo-2"));
     }
 
     std::cout << "--cambine:" << binary_sizes << std::endl;
     //copy over all of the generated binaries.
-    for (int i = 0; i < deviceListSize; i++)
+    for (int i = 0; i < program_devices; i++)
         binaries[i] = (char *)malloc(sizeof(char) * (binary_sizes[i] + 1));
-    oclHandles.cl_status = clGetProgramInfo(oclHandles.program, CL_PROGRAM_BINARIES, sizeof(char *) * deviceListSize, binaries, NULL);
-    if (oclHandles.cl_status != CL_SUCCESS)
+    cl_env->cl_status = clGetProgramInfo(cl_env->program, CL_PROGRAM_BINARIES, sizeof(char *) * program_devices, binaries, NULL);
+    if (cl_env->cl_status != CL_SUCCESS)
     {
         throw(string("--cambine:exception in _InitCL -> clGetProgramInfo-3"));
     }
-    for (int i = 0; i < deviceListSize; i++)
+    for (int i = 0; i < program_devices; i++)
         binaries[i][binary_sizes[i]] = '\0';
     std::cout << "--cambine:writing ptd information..." << std::endl;
     FILE *ptx_file = fopen("cl.ptx", "w");
@@ -402,17 +754,17 @@ void _clInit()
     {
         throw(string("exceptions in allocate ptx file."));
     }
-    fprintf(ptx_file, "%s", binaries[DEVICE_ID_inuse]);
+    fprintf(ptx_file, "%s", binaries[cl_env->device_id < program_devices ? cl_env->device_id : 0]);
     fclose(ptx_file);
     std::cout << "--cambine:writing ptd information done." << std::endl;
-    for (int i = 0; i < deviceListSize; i++)
+    for (int i = 0; i < program_devices; i++)
         free(binaries[i]);
 #endif
 
     for (int nKernel = 0; nKernel < total_kernels; nKernel++)
     {
         /* get a kernel object handle for a kernel with the given name */
-        cl_kernel kernel = clCreateKernel(oclHandles.program,
+        cl_kernel kernel = clCreateKernel(cl_env->program,
                                           (kernel_names[nKernel]).c_str(),
                                           &resultCL);
 
@@ -422,21 +774,21 @@ void _clInit()
             throw(errorMsg);
         }
 
-        oclHandles.kernel.push_back(kernel);
+        cl_env->kernel.push_back(CLKernel(kernel));
     }
     //get resource alocation information
 #ifdef RES_MSG
     char *build_log;
     size_t ret_val_size;
-    oclHandles.cl_status = clGetProgramBuildInfo(oclHandles.program, oclHandles.devices[DEVICE_ID_inuse], CL_PROGRAM_BUILD_LOG, 0, NULL, &ret_val_size);
-    if (oclHandles.cl_status != CL_SUCCESS)
+    cl_env->cl_status = clGetProgramBuildInfo(cl_env->program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &ret_val_size);
+    if (cl_env->cl_status != CL_SUCCESS)
     {
         throw(string("exceptions in _InitCL -> getting resource information"));
     }
 
     build_log = (char *)malloc(ret_val_size + 1);
-    oclHandles.cl_status = clGetProgramBuildInfo(oclHandles.program, oclHandles.devices[DEVICE_ID_inuse], CL_PROGRAM_BUILD_LOG, ret_val_size, build_log, NULL);
-    if (oclHandles.cl_status != CL_SUCCESS)
+    cl_env->cl_status = clGetProgramBuildInfo(cl_env->program, device, CL_PROGRAM_BUILD_LOG, ret_val_size, build_log, NULL);
+    if (cl_env->cl_status != CL_SUCCESS)
     {
         throw(string("exceptions in _InitCL -> getting resources allocation information-2"));
     }
@@ -453,13 +805,13 @@ void _clInit()
     cl_uint computeunits;
     size_t groupsize;
     
-    cl_int result1 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_NAME, sizeof(name), name, NULL);
-    cl_int result2 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
-    cl_int result3 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clockfreq), &clockfreq, NULL);
-    cl_int result4 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeunits), &computeunits, NULL);
-    cl_int result5 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(groupsize), &groupsize, NULL);
-    cl_int result6 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DRIVER_VERSION, sizeof(driver_version), &driver_version, NULL);
-    cl_int result7 = clGetDeviceInfo(oclHandles.devices[DEVICE_ID_inuse], CL_DEVICE_VERSION, sizeof(opencl_version), &opencl_version, NULL);
+    cl_int result1 = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    cl_int result2 = clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, NULL);
+    cl_int result3 = clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clockfreq), &clockfreq, NULL);
+    cl_int result4 = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeunits), &computeunits, NULL);
+    cl_int result5 = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(groupsize), &groupsize, NULL);
+    cl_int result6 = clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver_version), &driver_version, NULL);
+    cl_int result7 = clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(opencl_version), &opencl_version, NULL);
 
     if(result1 != CL_SUCCESS || result2 != CL_SUCCESS || result3 != CL_SUCCESS || result4 != CL_SUCCESS || result5 != CL_SUCCESS || result6 != CL_SUCCESS || result7 != CL_SUCCESS)
     {
@@ -474,93 +826,328 @@ void _clInit()
 }
 
 //---------------------------------------
-//release CL objects
-void _clRelease()
+//Initlize CL objects
+//--description: there are 5 steps to initialize all the OpenCL objects needed
+//--revised on 04/01/2011: get the number of devices  and
+//  devices have no relationship with context
+//--the objects go into the current environment (cl_env); the defaults come
+//--from the command line
+void _clInit(bool cpu = ::cpu, int DEVICE_ID_inuse = device_id_inuse, MemoryMode memory_mode = ::memory_mode)
 {
-    char errorFlag = false;
+    cl_int resultCL;
+
+    cl_env->pool = BufferPool();
+    cl_env->kernel.clear();
+    cl_env->program.reset();
+    cl_env->node_queues.clear();
+    cl_env->node_devices.clear();
+    cl_env->transfer_queue.reset();
+    cl_env->queue.reset();
+    cl_env->context.reset();
+    cl_env->devices.clear();
+    cl_env->split_device.reset();
+    cl_env->device_id = DEVICE_ID_inuse;
+
+    cl_uint deviceListSize;
+
+    //-----------------------------------------------
+    //--cambine-1: find the available platforms and select one
+
+    cl_uint numPlatforms;
+    cl_platform_id targetPlatform = NULL;
+
+    resultCL = clGetPlatformIDs(0, NULL, &numPlatforms);
+    if (resultCL != CL_SUCCESS)
+    {
+        throw(string("InitCL()::Error: Getting number of platforms (clGetPlatformIDs)"));
+    }
+
+#ifdef VERBOSE
+    printf("Number of platforms: %d\n", numPlatforms);
+#endif
+
+    if (!(numPlatforms > 0))
+    {
+        throw(string("InitCL()::Error: No platforms found (clGetPlatformIDs)"));
+    }
+
+    cl_platform_id *allPlatforms = (cl_platform_id *)malloc(numPlatforms * sizeof(cl_platform_id));
+
+    resultCL = clGetPlatformIDs(numPlatforms, allPlatforms, NULL);
+    if (resultCL != CL_SUCCESS)
+        throw(string("InitCL()::Error: Getting platform ids (clGetPlatformIDs)"));
 
-    for (int nKernel = 0; nKernel < oclHandles.kernel.size(); nKernel++)
+    /* Select the target platform. Default: first platform */
+    targetPlatform = allPlatforms[cpu ? 1 : 0];
+    for (int i = 0; i < numPlatforms; i++)
     {
-        if (oclHandles.kernel[nKernel] != NULL)
+        char pbuff[128];
+        resultCL = clGetPlatformInfo(allPlatforms[i],
+                                     CL_PLATFORM_VENDOR,
+                                     sizeof(pbuff),
+                                     pbuff,
+                                     NULL);
+        if (resultCL != CL_SUCCESS)
+            throw(string("InitCL()::Error: Getting platform info (clGetPlatformInfo)"));
+
+#ifdef VERBOSE
+        printf("Vendor of platform %d is %s\n", i, pbuff);
+#endif
+    }
+
+#ifdef VERBOSE
+    printf("Using platform %d.\n", cpu ? 1 : 0);
+#endif
+
+    free(allPlatforms);
+
+    //-----------------------------------------------
+    //--cambine-2: create an OpenCL context
+    cl_context_properties cprops[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties)targetPlatform, 0};
+    cl_env->context = clCreateContextFromType(cprops,
+                                                 cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU,
+                                                 NULL,
+                                                 NULL,
+                                                 &resultCL);
+
+    if ((resultCL != CL_SUCCESS) || (cl_env->context == NULL))
+        throw(string("InitCL()::Error: Creating Context (clCreateContextFromType)"));
+    //-----------------------------------------------
+    //--cambine-3: detect OpenCL devices
+    /* First, get the size of device list */
+    cl_env->cl_status = clGetDeviceIDs(targetPlatform, cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU, 0, NULL, &deviceListSize);
+    if (cl_env->cl_status != CL_SUCCESS)
+    {
+        throw(string("exception in _clInit -> clGetDeviceIDs"));
+    }
+    if (deviceListSize == 0)
+        throw(string("InitCL()::Error: No devices found."));
+
+    //std::cout<<"device number:"<<deviceListSize<<std::endl;
+
+    /* Now, allocate the device list */
+    cl_env->devices.resize(deviceListSize);
+
+    /* Next, get the device list data */
+    cl_env->cl_status = clGetDeviceIDs(targetPlatform, cpu ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU, deviceListSize,
+                                       cl_env->devices.data(), NULL);
+    if (cl_env->cl_status != CL_SUCCESS)
+    {
+        throw(string("exception in _clInit -> clGetDeviceIDs-2"));
+    }
+
+    cl_bool result;
+    resultCL = clGetDeviceInfo(cl_env->devices[DEVICE_ID_inuse], CL_DEVICE_AVAILABLE, sizeof(result), &result, NULL);
+
+    if (resultCL != CL_SUCCESS)
+        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo)"));
+
+    if (!result) {
+        throw(string("Device %d is not available.\n", DEVICE_ID_inuse));
+    }
+
+    char vendor[128];
+    resultCL = clGetDeviceInfo(cl_env->devices[DEVICE_ID_inuse], CL_DEVICE_VENDOR, sizeof(vendor), vendor, NULL);
+
+    if (resultCL != CL_SUCCESS)
+        throw(string("InitCL()::Error: Getting device info (clGetDeviceInfo-2)"));
+
+#ifdef VERBOSE
+    printf("Vendor of selected device %d is %s\n", DEVICE_ID_inuse, vendor);
+#endif
+
+    //--NUMA: one sub-device per node next to the whole device, all in a
+    //--context of their own
+    if (numa_mode && cpu)
+    {
+        cl_device_partition_property partition[3] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+        cl_uint count = 0;
+        if (clCreateSubDevices(cl_env->devices[DEVICE_ID_inuse], partition, 0, NULL, &count) == CL_SUCCESS && count > 1)
         {
-            cl_int resultCL = clReleaseKernel(oclHandles.kernel[nKernel]);
+            std::vector<cl_device_id> sub_devices(count);
+            resultCL = clCreateSubDevices(cl_env->devices[DEVICE_ID_inuse], partition, count, sub_devices.data(), NULL);
             if (resultCL != CL_SUCCESS)
-            {
-                cerr << "ReleaseCL()::Error: In clReleaseKernel" << endl;
-                errorFlag = true;
-            }
-            oclHandles.kernel[nKernel] = NULL;
+                throw(string("InitCL()::Error: Creating NUMA sub-devices (clCreateSubDevices)"));
+            for (cl_uint i = 0; i < count; i++)
+                cl_env->node_devices.push_back(CLDevice(sub_devices[i]));
+
+            std::vector<cl_device_id> context_devices(1, cl_env->devices[DEVICE_ID_inuse]);
+            context_devices.insert(context_devices.end(), sub_devices.begin(), sub_devices.end());
+            cl_env->context = clCreateContext(cprops, context_devices.size(), context_devices.data(), NULL, NULL, &resultCL);
+            if ((resultCL != CL_SUCCESS) || (cl_env->context == NULL))
+                throw(string("InitCL()::Error: Creating NUMA context (clCreateContext)"));
         }
-        oclHandles.kernel.clear();
+#ifdef VERBOSE
+        printf("%u NUMA sub-devices\n", (unsigned)cl_env->node_devices.size());
+#endif
+    }
+
+    _clInitDevice(memory_mode);
+}
+
+//---------------------------------------
+//--device fission: split the device of the current environment into parts
+//--sub-devices on disjoint compute units (0: one per NUMA node) and set up a
+//--complete environment on each, so independent queries can run side by side
+//--from threads that bind them with CLBinding. The current environment is
+//--left as it is.
+std::vector<CLEnvironment> _clSplit(int parts, MemoryMode memory_mode = ::memory_mode)
+{
+    cl_int resultCL;
+    cl_device_id device = cl_env->devices[cl_env->device_id];
+
+    cl_uint units;
+    cl_platform_id platform;
+    if (clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL) != CL_SUCCESS ||
+        clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL) != CL_SUCCESS)
+        throw(string("_clSplit()::Error: Getting device info (clGetDeviceInfo)"));
+
+    //--by counts: the compute units dealt out as evenly as they go
+    std::vector<cl_device_partition_property> partition;
+    if (parts > 0)
+    {
+        if ((cl_uint)parts > units)
+            throw(string("_clSplit()::Error: More sub-devices than compute units (") + std::to_string(units) + ")");
+        partition.push_back(CL_DEVICE_PARTITION_BY_COUNTS);
+        for (int i = 0; i < parts; i++)
+            partition.push_back(units / parts + (i < (int)(units % parts) ? 1 : 0));
+        partition.push_back(CL_DEVICE_PARTITION_BY_COUNTS_LIST_END);
     }
+    else
+    {
+        partition.push_back(CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN);
+        partition.push_back(CL_DEVICE_AFFINITY_DOMAIN_NUMA);
+    }
+    partition.push_back(0);
+
+    cl_uint count = 0;
+    resultCL = clCreateSubDevices(device, partition.data(), 0, NULL, &count);
+    if (resultCL != CL_SUCCESS || count == 0)
+        throw(string("_clSplit()::Error: Device cannot be split (clCreateSubDevices)"));
+    std::vector<cl_device_id> sub_devices(count);
+    resultCL = clCreateSubDevices(device, partition.data(), count, sub_devices.data(), NULL);
+    if (resultCL != CL_SUCCESS)
+        throw(string("_clSplit()::Error: Creating sub-devices (clCreateSubDevices)"));
 
-    if (oclHandles.program != NULL)
+    std::vector<CLEnvironment> envs(count);
+    for (cl_uint i = 0; i < count; i++)
+        envs[i].split_device = CLDevice(sub_devices[i]);
+
+    cl_context_properties cprops[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties)platform, 0};
+    for (cl_uint i = 0; i < count; i++)
     {
-        cl_int resultCL = clReleaseProgram(oclHandles.program);
-        if (resultCL != CL_SUCCESS)
+        CLBinding binding(envs[i]);
+        cl_env->devices.assign(1, sub_devices[i]);
+        cl_env->device_id = 0;
+        cl_env->context = clCreateContext(cprops, 1, &sub_devices[i], NULL, NULL, &resultCL);
+        if ((resultCL != CL_SUCCESS) || (cl_env->context == NULL))
+            throw(string("_clSplit()::Error: Creating sub-device context (clCreateContext)"));
+        _clInitDevice(memory_mode);
+    }
+    return envs;
+}
+
+//---------------------------------------
+//release CL objects of the current environment
+void _clRelease()
+{
+    char errorFlag = false;
+
+    traceCollect();
+    cl_env->pool.clear();
+
+    for (int nKernel = 0; nKernel < cl_env->kernel.size(); nKernel++)
+    {
+        if (cl_env->kernel[nKernel].reset() != CL_SUCCESS)
         {
-            cerr << "ReleaseCL()::Error: In clReleaseProgram" << endl;
+            cerr << "ReleaseCL()::Error: In clReleaseKernel" << endl;
             errorFlag = true;
         }
-        oclHandles.program = NULL;
     }
+    cl_env->kernel.clear();
 
-    if (oclHandles.queue != NULL)
+    if (cl_env->program.reset() != CL_SUCCESS)
     {
-        cl_int resultCL = clReleaseCommandQueue(oclHandles.queue);
-        if (resultCL != CL_SUCCESS)
+        cerr << "ReleaseCL()::Error: In clReleaseProgram" << endl;
+        errorFlag = true;
+    }
+
+    if (cl_env->queue.reset() != CL_SUCCESS)
+    {
+        cerr << "ReleaseCL()::Error: In clReleaseCommandQueue" << endl;
+        errorFlag = true;
+    }
+
+    if (cl_env->transfer_queue.reset() != CL_SUCCESS)
+    {
+        cerr << "ReleaseCL()::Error: In clReleaseCommandQueue" << endl;
+        errorFlag = true;
+    }
+
+    for (size_t i = 0; i < cl_env->node_queues.size(); i++)
+    {
+        if (cl_env->node_queues[i].reset() != CL_SUCCESS)
         {
             cerr << "ReleaseCL()::Error: In clReleaseCommandQueue" << endl;
             errorFlag = true;
         }
-        oclHandles.queue = NULL;
     }
+    cl_env->node_queues.clear();
+    cl_env->node_devices.clear();
 
-    free(oclHandles.devices);
+    cl_env->devices.clear();
 
-    if (oclHandles.context != NULL)
+    if (cl_env->context.reset() != CL_SUCCESS)
     {
-        cl_int resultCL = clReleaseContext(oclHandles.context);
-        if (resultCL != CL_SUCCESS)
-        {
-            cerr << "ReleaseCL()::Error: In clReleaseContext" << endl;
-            errorFlag = true;
-        }
-        oclHandles.context = NULL;
+        cerr << "ReleaseCL()::Error: In clReleaseContext" << endl;
+        errorFlag = true;
     }
+    cl_env->split_device.reset();
 
     if (errorFlag) {
         throw(string("ReleaseCL()::Error encountered."));
     }
 }
 
+//---------------------------------------
+//release a set of environments (_clSplit, partitioned devices)
+void _clReleaseAll(std::vector<CLEnvironment> &envs)
+{
+    for (size_t i = 0; i < envs.size(); i++)
+    {
+        CLBinding binding(envs[i]);
+        _clRelease();
+    }
+    envs.clear();
+}
+
 cl_mem _clCreateBuffer(cl_mem_flags flags, size_t size, void *host_ptr)
 {
     cl_mem d_mem;
-    d_mem = clCreateBuffer(oclHandles.context, flags, size, host_ptr, &oclHandles.cl_status);
+    d_mem = clCreateBuffer(cl_env->context, flags, size, host_ptr, &cl_env->cl_status);
 
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clCreateBuffer -> ";
-    switch(oclHandles.cl_status) {
+    cl_env->error_str = "exception in _clCreateBuffer -> ";
+    switch(cl_env->cl_status) {
         case CL_INVALID_CONTEXT:
-            oclHandles.error_str += "CL_INVALID_CONTEXT";
+            cl_env->error_str += "CL_INVALID_CONTEXT";
             break;
         case CL_INVALID_VALUE:
-            oclHandles.error_str += "CL_INVALID_VALUE";
+            cl_env->error_str += "CL_INVALID_VALUE";
             break;
         case CL_INVALID_HOST_PTR:
-            oclHandles.error_str += "CL_INVALID_HOST_PTR";
+            cl_env->error_str += "CL_INVALID_HOST_PTR";
             break;
         case CL_MEM_OBJECT_ALLOCATION_FAILURE:
-            oclHandles.error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
+            cl_env->error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
             break;
         case CL_OUT_OF_HOST_MEMORY:
-            oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+            cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
             break;
     }
 
-    if (oclHandles.cl_status != CL_SUCCESS)
-        throw(oclHandles.error_str);
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(cl_env->error_str);
 #endif
     return d_mem;
 }
@@ -592,11 +1179,26 @@ cl_mem _clMalloc(int size, void *h_mem_ptr)
 cl_event _clMemcpyH2D(cl_mem d_mem, int size, const void *h_mem_ptr)
 {
     cl_event event;
-    oclHandles.cl_status = clEnqueueWriteBuffer(oclHandles.queue, d_mem, CL_TRUE, 0, size, h_mem_ptr, 0, NULL, &event);
+    cl_env->cl_status = clEnqueueWriteBuffer(cl_env->queue, d_mem, CL_TRUE, 0, size, h_mem_ptr, 0, NULL, &event);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clMemcpyH2D"));
 #endif
+    traceCommand(event, "h2d", "H2D " + std::to_string(size) + " B");
+    return event;
+}
+//-------------------------------------------------------
+//non-blocking transfer of size bytes to d_mem + offset on the transfer queue.
+//h_mem_ptr must stay untouched until the returned event completes.
+cl_event _clMemcpyH2DAsync(cl_mem d_mem, size_t offset, int size, const void *h_mem_ptr)
+{
+    cl_event event;
+    cl_env->cl_status = clEnqueueWriteBuffer(cl_env->transfer_queue, d_mem, CL_FALSE, offset, size, h_mem_ptr, 0, NULL, &event);
+#ifdef ERRMSG
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(string("exception in _clMemcpyH2DAsync"));
+#endif
+    traceCommand(event, "h2d", "H2D async " + std::to_string(size) + " B");
     return event;
 }
 //--------------------------------------------------------
@@ -606,25 +1208,25 @@ cl_mem _clCreateAndCpyPinnedMem(int size, float *h_mem_source)
 {
     cl_mem d_mem, d_mem_pinned;
     float *h_mem_pinned = NULL;
-    d_mem_pinned = clCreateBuffer(oclHandles.context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
-                                  size, NULL, &oclHandles.cl_status);
+    d_mem_pinned = clCreateBuffer(cl_env->context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                  size, NULL, &cl_env->cl_status);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clCreateAndCpyMem()->d_mem_pinned"));
 #endif
     //------------
-    d_mem = clCreateBuffer(oclHandles.context, CL_MEM_READ_ONLY,
-                           size, NULL, &oclHandles.cl_status);
+    d_mem = clCreateBuffer(cl_env->context, CL_MEM_READ_ONLY,
+                           size, NULL, &cl_env->cl_status);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clCreateAndCpyMem() -> d_mem "));
 #endif
     //----------
-    h_mem_pinned = (cl_float *)clEnqueueMapBuffer(oclHandles.queue, d_mem_pinned, CL_TRUE,
+    h_mem_pinned = (cl_float *)clEnqueueMapBuffer(cl_env->queue, d_mem_pinned, CL_TRUE,
                                                   CL_MAP_WRITE, 0, size, 0, NULL,
-                                                  NULL, &oclHandles.cl_status);
+                                                  NULL, &cl_env->cl_status);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clCreateAndCpyMem() -> clEnqueueMapBuffer"));
 #endif
     int element_number = size / sizeof(float);
@@ -634,25 +1236,67 @@ cl_mem _clCreateAndCpyPinnedMem(int size, float *h_mem_source)
         h_mem_pinned[i] = h_mem_source[i];
     }
     //----------
-    oclHandles.cl_status = clEnqueueWriteBuffer(oclHandles.queue, d_mem,
+    cl_env->cl_status = clEnqueueWriteBuffer(cl_env->queue, d_mem,
                                                 CL_TRUE, 0, size, h_mem_pinned,
                                                 0, NULL, NULL);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clCreateAndCpyMem() -> clEnqueueWriteBuffer"));
 #endif
 
     return d_mem;
 }
 
+//-------------------------------------------------------
+//create a buffer that lives in the given host allocation (zero-copy)
+cl_mem _clMallocHost(int size, void *h_mem_ptr)
+{
+    return _clCreateBuffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, h_mem_ptr);
+}
+//-------------------------------------------------------
+//create a buffer in host-accessible memory allocated by the runtime
+cl_mem _clMallocMapped(int size)
+{
+    return _clCreateBuffer(CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL);
+}
+
+//--------------------------------------------------------
+//blocking map of a whole buffer into the host address space
+void *_clMap(cl_mem d_mem, int size, cl_map_flags flags, cl_event *event)
+{
+    cl_event map_event = NULL;
+    void *h_mem = clEnqueueMapBuffer(cl_env->queue, d_mem, CL_TRUE, flags, 0, size, 0, NULL, &map_event, &cl_env->cl_status);
+#ifdef ERRMSG
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(string("exception in _clMap"));
+#endif
+    traceCommand(map_event, (flags & CL_MAP_READ) ? "d2h" : "h2d", "Map " + std::to_string(size) + " B");
+    if (event)
+        *event = map_event;
+    else if (map_event)
+        clReleaseEvent(map_event);
+    return h_mem;
+}
+cl_event _clUnmap(cl_mem d_mem, void *h_mem)
+{
+    cl_event event;
+    cl_env->cl_status = clEnqueueUnmapMemObject(cl_env->queue, d_mem, h_mem, 0, NULL, &event);
+#ifdef ERRMSG
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(string("exception in _clUnmap"));
+#endif
+    traceCommand(event, "h2d", "Unmap");
+    return event;
+}
+
 //--------------------------------------------------------
 //--cambine:create write only buffer on device
 cl_mem _clMallocWO(int size)
 {
     cl_mem d_mem;
-    d_mem = clCreateBuffer(oclHandles.context, CL_MEM_WRITE_ONLY, size, 0, &oclHandles.cl_status);
+    d_mem = clCreateBuffer(cl_env->context, CL_MEM_WRITE_ONLY, size, 0, &cl_env->cl_status);
 #ifdef ERRMSG
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
         throw(string("exception in _clCreateMem()"));
 #endif
     return d_mem;
@@ -663,51 +1307,52 @@ cl_mem _clMallocWO(int size)
 cl_event _clMemcpyD2H(cl_mem d_mem, int size, void *h_mem)
 {
     cl_event event;
-    oclHandles.cl_status = clEnqueueReadBuffer(oclHandles.queue, d_mem, CL_TRUE, 0, size, h_mem, 0, 0, &event);
+    cl_env->cl_status = clEnqueueReadBuffer(cl_env->queue, d_mem, CL_TRUE, 0, size, h_mem, 0, 0, &event);
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clCpyMemD2H -> ";
-    switch (oclHandles.cl_status)
+    cl_env->error_str = "exception in _clCpyMemD2H -> ";
+    switch (cl_env->cl_status)
     {
     case CL_INVALID_COMMAND_QUEUE:
-        oclHandles.error_str += "CL_INVALID_COMMAND_QUEUE";
+        cl_env->error_str += "CL_INVALID_COMMAND_QUEUE";
         break;
     case CL_INVALID_CONTEXT:
-        oclHandles.error_str += "CL_INVALID_CONTEXT";
+        cl_env->error_str += "CL_INVALID_CONTEXT";
         break;
     case CL_INVALID_MEM_OBJECT:
-        oclHandles.error_str += "CL_INVALID_MEM_OBJECT";
+        cl_env->error_str += "CL_INVALID_MEM_OBJECT";
         break;
     case CL_INVALID_VALUE:
-        oclHandles.error_str += "CL_INVALID_VALUE";
+        cl_env->error_str += "CL_INVALID_VALUE";
         break;
     case CL_INVALID_EVENT_WAIT_LIST:
-        oclHandles.error_str += "CL_INVALID_EVENT_WAIT_LIST";
+        cl_env->error_str += "CL_INVALID_EVENT_WAIT_LIST";
         break;
     case CL_MISALIGNED_SUB_BUFFER_OFFSET:
-        oclHandles.error_str += "CL_MISALIGNED_SUB_BUFFER_OFFSET";
+        cl_env->error_str += "CL_MISALIGNED_SUB_BUFFER_OFFSET";
         break;
     case CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST:
-        oclHandles.error_str += "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
+        cl_env->error_str += "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
         break;
     case CL_MEM_OBJECT_ALLOCATION_FAILURE:
-        oclHandles.error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
+        cl_env->error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
         break;
     case CL_INVALID_OPERATION:
-        oclHandles.error_str += "CL_INVALID_OPERATION";
+        cl_env->error_str += "CL_INVALID_OPERATION";
         break;
     case CL_OUT_OF_RESOURCES:
-        oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+        cl_env->error_str += "CL_OUT_OF_RESOURCES";
         break;
     case CL_OUT_OF_HOST_MEMORY:
-        oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+        cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
         break;
     default:
-        oclHandles.error_str += "Unknown reason";
+        cl_env->error_str += "Unknown reason";
         break;
     }
-    if (oclHandles.cl_status != CL_SUCCESS)
-        throw(oclHandles.error_str);
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(cl_env->error_str);
 #endif
+    traceCommand(event, "d2h", "D2H " + std::to_string(size) + " B");
     return event;
 }
 
@@ -717,112 +1362,126 @@ void _clSetArgs(int kernel_id, int arg_idx, void *d_mem, int size = 0)
 {
     if (!size)
     {
-        oclHandles.cl_status = clSetKernelArg(oclHandles.kernel[kernel_id], arg_idx, sizeof(d_mem), &d_mem);
+        cl_env->cl_status = clSetKernelArg(cl_env->kernel[kernel_id], arg_idx, sizeof(d_mem), &d_mem);
 #ifdef ERRMSG
-        oclHandles.error_str = "exception in _clSetKernelArg() ";
-        switch (oclHandles.cl_status)
+        cl_env->error_str = "exception in _clSetKernelArg() ";
+        switch (cl_env->cl_status)
         {
         case CL_INVALID_KERNEL:
-            oclHandles.error_str += "CL_INVALID_KERNEL";
+            cl_env->error_str += "CL_INVALID_KERNEL";
             break;
         case CL_INVALID_ARG_INDEX:
-            oclHandles.error_str += "CL_INVALID_ARG_INDEX";
+            cl_env->error_str += "CL_INVALID_ARG_INDEX";
             break;
         case CL_INVALID_ARG_VALUE:
-            oclHandles.error_str += "CL_INVALID_ARG_VALUE";
+            cl_env->error_str += "CL_INVALID_ARG_VALUE";
             break;
         case CL_INVALID_MEM_OBJECT:
-            oclHandles.error_str += "CL_INVALID_MEM_OBJECT";
+            cl_env->error_str += "CL_INVALID_MEM_OBJECT";
             break;
         case CL_INVALID_SAMPLER:
-            oclHandles.error_str += "CL_INVALID_SAMPLER";
+            cl_env->error_str += "CL_INVALID_SAMPLER";
             break;
         case CL_INVALID_ARG_SIZE:
-            oclHandles.error_str += "CL_INVALID_ARG_SIZE";
+            cl_env->error_str += "CL_INVALID_ARG_SIZE";
             break;
         case CL_OUT_OF_RESOURCES:
-            oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+            cl_env->error_str += "CL_OUT_OF_RESOURCES";
             break;
         case CL_OUT_OF_HOST_MEMORY:
-            oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+            cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
             break;
         default:
-            oclHandles.error_str += "Unknown reason";
+            cl_env->error_str += "Unknown reason";
             break;
         }
-        if (oclHandles.cl_status != CL_SUCCESS)
-            throw(oclHandles.error_str);
+        if (cl_env->cl_status != CL_SUCCESS)
+            throw(cl_env->error_str);
 #endif
     }
     else
     {
-        oclHandles.cl_status = clSetKernelArg(oclHandles.kernel[kernel_id], arg_idx, size, d_mem);
+        cl_env->cl_status = clSetKernelArg(cl_env->kernel[kernel_id], arg_idx, size, d_mem);
 #ifdef ERRMSG
-        oclHandles.error_str = "exception in _clSetKernelArg() ";
-        switch (oclHandles.cl_status)
+        cl_env->error_str = "exception in _clSetKernelArg() ";
+        switch (cl_env->cl_status)
         {
         case CL_INVALID_KERNEL:
-            oclHandles.error_str += "CL_INVALID_KERNEL";
+            cl_env->error_str += "CL_INVALID_KERNEL";
             break;
         case CL_INVALID_ARG_INDEX:
-            oclHandles.error_str += "CL_INVALID_ARG_INDEX";
+            cl_env->error_str += "CL_INVALID_ARG_INDEX";
             break;
         case CL_INVALID_ARG_VALUE:
-            oclHandles.error_str += "CL_INVALID_ARG_VALUE";
+            cl_env->error_str += "CL_INVALID_ARG_VALUE";
             break;
         case CL_INVALID_MEM_OBJECT:
-            oclHandles.error_str += "CL_INVALID_MEM_OBJECT";
+            cl_env->error_str += "CL_INVALID_MEM_OBJECT";
             break;
         case CL_INVALID_SAMPLER:
-            oclHandles.error_str += "CL_INVALID_SAMPLER";
+            cl_env->error_str += "CL_INVALID_SAMPLER";
             break;
         case CL_INVALID_ARG_SIZE:
-            oclHandles.error_str += "CL_INVALID_ARG_SIZE";
+            cl_env->error_str += "CL_INVALID_ARG_SIZE";
             break;
         case CL_OUT_OF_RESOURCES:
-            oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+            cl_env->error_str += "CL_OUT_OF_RESOURCES";
             break;
         case CL_OUT_OF_HOST_MEMORY:
-            oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+            cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
             break;
         default:
-            oclHandles.error_str += "Unknown reason";
+            cl_env->error_str += "Unknown reason";
             break;
         }
-        if (oclHandles.cl_status != CL_SUCCESS)
-            throw(oclHandles.error_str);
+        if (cl_env->cl_status != CL_SUCCESS)
+            throw(cl_env->error_str);
 #endif
     }
 }
+//--------------------------------------------------------
+//fill a device buffer with a repeated int value
+cl_event _clMemset(cl_mem d_mem, int value, int size)
+{
+    cl_event event;
+    cl_env->cl_status = clEnqueueFillBuffer(cl_env->queue, d_mem, &value, sizeof(int), 0, size, 0, NULL, &event);
+#ifdef ERRMSG
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(string("exception in _clMemset"));
+#endif
+    traceCommand(event, "kernel", "Fill " + std::to_string(size) + " B");
+    return event;
+}
 void _clFinish()
 {
-    oclHandles.cl_status = clFinish(oclHandles.queue);
+    cl_env->cl_status = clFinish(cl_env->queue);
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clFinish";
-    switch (oclHandles.cl_status)
+    cl_env->error_str = "exception in _clFinish";
+    switch (cl_env->cl_status)
     {
     case CL_INVALID_COMMAND_QUEUE:
-        oclHandles.error_str += "CL_INVALID_COMMAND_QUEUE";
+        cl_env->error_str += "CL_INVALID_COMMAND_QUEUE";
         break;
     case CL_OUT_OF_RESOURCES:
-        oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+        cl_env->error_str += "CL_OUT_OF_RESOURCES";
         break;
     case CL_OUT_OF_HOST_MEMORY:
-        oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+        cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
         break;
     default:
-        oclHandles.error_str += "Unknown reasons";
+        cl_env->error_str += "Unknown reasons";
         break;
     }
-    if (oclHandles.cl_status != CL_SUCCESS)
+    if (cl_env->cl_status != CL_SUCCESS)
     {
-        throw(oclHandles.error_str);
+        throw(cl_env->error_str);
     }
 #endif
 }
 //--------------------------------------------------------
 //--cambine:enqueue kernel
-cl_event _clInvokeKernel(int kernel_id, size_t work_items, size_t work_group_size)
+//--on a given queue of the environment, global ids starting at offset
+cl_event _clInvokeKernelOn(cl_command_queue queue, int kernel_id, size_t offset, size_t work_items, size_t work_group_size, cl_uint num_events = 0, const cl_event *wait_list = NULL)
 {
     cl_uint work_dim = WORK_DIM;
     cl_event event;
@@ -830,69 +1489,77 @@ cl_event _clInvokeKernel(int kernel_id, size_t work_items, size_t work_group_siz
         work_items = work_items + (work_group_size - (work_items % work_group_size));
     size_t local_work_size[] = {work_group_size, 1};
     size_t global_work_size[] = {work_items, 1};
-    oclHandles.cl_status = clEnqueueNDRangeKernel(oclHandles.queue, oclHandles.kernel[kernel_id], work_dim, 0,
-                                                  global_work_size, local_work_size, 0, 0, &event);
+    size_t global_work_offset[] = {offset, 0};
+    cl_env->cl_status = clEnqueueNDRangeKernel(queue, cl_env->kernel[kernel_id], work_dim, global_work_offset,
+                                                  global_work_size, local_work_size, num_events, wait_list, &event);
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clInvokeKernel() -> ";
-    switch (oclHandles.cl_status)
+    cl_env->error_str = "exception in _clInvokeKernel() -> ";
+    switch (cl_env->cl_status)
     {
     case CL_INVALID_PROGRAM_EXECUTABLE:
-        oclHandles.error_str += "CL_INVALID_PROGRAM_EXECUTABLE";
+        cl_env->error_str += "CL_INVALID_PROGRAM_EXECUTABLE";
         break;
     case CL_INVALID_COMMAND_QUEUE:
-        oclHandles.error_str += "CL_INVALID_COMMAND_QUEUE";
+        cl_env->error_str += "CL_INVALID_COMMAND_QUEUE";
         break;
     case CL_INVALID_KERNEL:
-        oclHandles.error_str += "CL_INVALID_KERNEL";
+        cl_env->error_str += "CL_INVALID_KERNEL";
         break;
     case CL_INVALID_CONTEXT:
-        oclHandles.error_str += "CL_INVALID_CONTEXT";
+        cl_env->error_str += "CL_INVALID_CONTEXT";
         break;
     case CL_INVALID_KERNEL_ARGS:
-        oclHandles.error_str += "CL_INVALID_KERNEL_ARGS";
+        cl_env->error_str += "CL_INVALID_KERNEL_ARGS";
         break;
     case CL_INVALID_WORK_DIMENSION:
-        oclHandles.error_str += "CL_INVALID_WORK_DIMENSION";
+        cl_env->error_str += "CL_INVALID_WORK_DIMENSION";
         break;
     case CL_INVALID_GLOBAL_WORK_SIZE:
-        oclHandles.error_str += "CL_INVALID_GLOBAL_WORK_SIZE";
+        cl_env->error_str += "CL_INVALID_GLOBAL_WORK_SIZE";
         break;
     case CL_INVALID_WORK_GROUP_SIZE:
-        oclHandles.error_str += "CL_INVALID_WORK_GROUP_SIZE";
+        cl_env->error_str += "CL_INVALID_WORK_GROUP_SIZE";
         break;
     case CL_INVALID_WORK_ITEM_SIZE:
-        oclHandles.error_str += "CL_INVALID_WORK_ITEM_SIZE";
+        cl_env->error_str += "CL_INVALID_WORK_ITEM_SIZE";
         break;
     case CL_INVALID_GLOBAL_OFFSET:
-        oclHandles.error_str += "CL_INVALID_GLOBAL_OFFSET";
+        cl_env->error_str += "CL_INVALID_GLOBAL_OFFSET";
         break;
     case CL_OUT_OF_RESOURCES:
-        oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+        cl_env->error_str += "CL_OUT_OF_RESOURCES";
         break;
     case CL_MEM_OBJECT_ALLOCATION_FAILURE:
-        oclHandles.error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
+        cl_env->error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
         break;
     case CL_INVALID_EVENT_WAIT_LIST:
-        oclHandles.error_str += "CL_INVALID_EVENT_WAIT_LIST";
+        cl_env->error_str += "CL_INVALID_EVENT_WAIT_LIST";
         break;
     case CL_OUT_OF_HOST_MEMORY:
-        oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+        cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
         break;
     default:
-        oclHandles.error_str += "Unkown reseason";
+        cl_env->error_str += "Unkown reseason";
         break;
     }
-    if (oclHandles.cl_status != CL_SUCCESS)
-        throw(oclHandles.error_str);
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(cl_env->error_str);
 #endif
+    traceCommand(event, "kernel", kernel_names[kernel_id]);
     return event;
+}
+
+cl_event _clInvokeKernel(int kernel_id, size_t work_items, size_t work_group_size, cl_uint num_events = 0, const cl_event *wait_list = NULL)
+{
+    return _clInvokeKernelOn(cl_env->queue, kernel_id, 0, work_items, work_group_size, num_events, wait_list);
     //_clFinish();
-    // oclHandles.cl_status = clWaitForEvents(1, &e[0]);
+    // cl_env->cl_status = clWaitForEvents(1, &e[0]);
     // #ifdef ERRMSG
-    // if (oclHandles.cl_status!= CL_SUCCESS)
+    // if (cl_env->cl_status!= CL_SUCCESS)
     //     throw(string("exception in _clEnqueueNDRange() -> clWaitForEvents"));
     // #endif
 }
+
 void _clInvokeKernel2D(int kernel_id, size_t range_x, size_t range_y, size_t group_x, size_t group_y)
 {
     cl_uint work_dim = WORK_DIM;
@@ -901,67 +1568,67 @@ void _clInvokeKernel2D(int kernel_id, size_t range_x, size_t range_y, size_t gro
     cl_event e[1];
     /*if(work_items%work_group_size != 0)	//process situations that work_items cannot be divided by work_group_size
       work_items = work_items + (work_group_size-(work_items%work_group_size));*/
-    oclHandles.cl_status = clEnqueueNDRangeKernel(oclHandles.queue, oclHandles.kernel[kernel_id], work_dim, 0,
+    cl_env->cl_status = clEnqueueNDRangeKernel(cl_env->queue, cl_env->kernel[kernel_id], work_dim, 0,
                                                   global_work_size, local_work_size, 0, 0, &(e[0]));
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clInvokeKernel() -> ";
-    switch (oclHandles.cl_status)
+    cl_env->error_str = "exception in _clInvokeKernel() -> ";
+    switch (cl_env->cl_status)
     {
     case CL_INVALID_PROGRAM_EXECUTABLE:
-        oclHandles.error_str += "CL_INVALID_PROGRAM_EXECUTABLE";
+        cl_env->error_str += "CL_INVALID_PROGRAM_EXECUTABLE";
         break;
     case CL_INVALID_COMMAND_QUEUE:
-        oclHandles.error_str += "CL_INVALID_COMMAND_QUEUE";
+        cl_env->error_str += "CL_INVALID_COMMAND_QUEUE";
         break;
     case CL_INVALID_KERNEL:
-        oclHandles.error_str += "CL_INVALID_KERNEL";
+        cl_env->error_str += "CL_INVALID_KERNEL";
         break;
     case CL_INVALID_CONTEXT:
-        oclHandles.error_str += "CL_INVALID_CONTEXT";
+        cl_env->error_str += "CL_INVALID_CONTEXT";
         break;
     case CL_INVALID_KERNEL_ARGS:
-        oclHandles.error_str += "CL_INVALID_KERNEL_ARGS";
+        cl_env->error_str += "CL_INVALID_KERNEL_ARGS";
         break;
     case CL_INVALID_WORK_DIMENSION:
-        oclHandles.error_str += "CL_INVALID_WORK_DIMENSION";
+        cl_env->error_str += "CL_INVALID_WORK_DIMENSION";
         break;
     case CL_INVALID_GLOBAL_WORK_SIZE:
-        oclHandles.error_str += "CL_INVALID_GLOBAL_WORK_SIZE";
+        cl_env->error_str += "CL_INVALID_GLOBAL_WORK_SIZE";
         break;
     case CL_INVALID_WORK_GROUP_SIZE:
-        oclHandles.error_str += "CL_INVALID_WORK_GROUP_SIZE";
+        cl_env->error_str += "CL_INVALID_WORK_GROUP_SIZE";
         break;
     case CL_INVALID_WORK_ITEM_SIZE:
-        oclHandles.error_str += "CL_INVALID_WORK_ITEM_SIZE";
+        cl_env->error_str += "CL_INVALID_WORK_ITEM_SIZE";
         break;
     case CL_INVALID_GLOBAL_OFFSET:
-        oclHandles.error_str += "CL_INVALID_GLOBAL_OFFSET";
+        cl_env->error_str += "CL_INVALID_GLOBAL_OFFSET";
         break;
     case CL_OUT_OF_RESOURCES:
-        oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+        cl_env->error_str += "CL_OUT_OF_RESOURCES";
         break;
     case CL_MEM_OBJECT_ALLOCATION_FAILURE:
-        oclHandles.error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
+        cl_env->error_str += "CL_MEM_OBJECT_ALLOCATION_FAILURE";
         break;
     case CL_INVALID_EVENT_WAIT_LIST:
-        oclHandles.error_str += "CL_INVALID_EVENT_WAIT_LIST";
+        cl_env->error_str += "CL_INVALID_EVENT_WAIT_LIST";
         break;
     case CL_OUT_OF_HOST_MEMORY:
-        oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+        cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
         break;
     default:
-        oclHandles.error_str += "Unkown reseason";
+        cl_env->error_str += "Unkown reseason";
         break;
     }
-    if (oclHandles.cl_status != CL_SUCCESS)
-        throw(oclHandles.error_str);
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(cl_env->error_str);
 #endif
     //_clFinish();
-    /*oclHandles.cl_status = clWaitForEvents(1, &e[0]);
+    /*cl_env->cl_status = clWaitForEvents(1, &e[0]);
 
     #ifdef ERRMSG
 
-        if (oclHandles.cl_status!= CL_SUCCESS)
+        if (cl_env->cl_status!= CL_SUCCESS)
 
             throw(string("exception in _clEnqueueNDRange() -> clWaitForEvents"));
 
@@ -973,58 +1640,235 @@ void _clInvokeKernel2D(int kernel_id, size_t range_x, size_t range_y, size_t gro
 void _clFree(cl_mem ob)
 {
     if (ob != NULL)
-        oclHandles.cl_status = clReleaseMemObject(ob);
+        cl_env->cl_status = clReleaseMemObject(ob);
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clFree() ->";
-    switch (oclHandles.cl_status)
+    cl_env->error_str = "exception in _clFree() ->";
+    switch (cl_env->cl_status)
     {
     case CL_INVALID_MEM_OBJECT:
-        oclHandles.error_str += "CL_INVALID_MEM_OBJECT";
+        cl_env->error_str += "CL_INVALID_MEM_OBJECT";
         break;
     case CL_OUT_OF_RESOURCES:
-        oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+        cl_env->error_str += "CL_OUT_OF_RESOURCES";
         break;
     case CL_OUT_OF_HOST_MEMORY:
-        oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+        cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
         break;
     default:
-        oclHandles.error_str += "Unkown reseason";
+        cl_env->error_str += "Unkown reseason";
         break;
     }
-    if (oclHandles.cl_status != CL_SUCCESS)
-        throw(oclHandles.error_str);
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(cl_env->error_str);
 #endif
 }
 
+//--------------------------------------------------------
+//--buffer pool of the current environment (BufferPool.h). A buffer from
+//--_clPoolAlloc holds at least size bytes and goes back with _clPoolFree.
+
+//--release the idle whole buffers; slabs stay, their slots are small
+void _clPoolTrim()
+{
+    BufferPool &pool = cl_env->pool;
+    for (auto it = pool.idle.begin(); it != pool.idle.end(); ++it)
+    {
+        std::vector<cl_mem> &free_list = it->second;
+        if (free_list.empty() || pool.owned[free_list[0]].slot)
+            continue;
+        for (size_t i = 0; i < free_list.size(); i++)
+        {
+            clReleaseMemObject(free_list[i]);
+            pool.owned.erase(free_list[i]);
+            pool.device_bytes -= it->first.second;
+        }
+        free_list.clear();
+    }
+}
+
+static cl_mem poolCreate(cl_mem_flags flags, size_t size)
+{
+    BufferPool &pool = cl_env->pool;
+    cl_mem d_mem = clCreateBuffer(cl_env->context, flags, size, NULL, &cl_env->cl_status);
+    if (cl_env->cl_status == CL_MEM_OBJECT_ALLOCATION_FAILURE || cl_env->cl_status == CL_OUT_OF_RESOURCES)
+    {
+        //--idle buffers of other classes may be what is missing
+        _clPoolTrim();
+        d_mem = clCreateBuffer(cl_env->context, flags, size, NULL, &cl_env->cl_status);
+    }
+    if (cl_env->cl_status != CL_SUCCESS)
+        throw(string("exception in _clPoolAlloc -> clCreateBuffer of ") + std::to_string(size) + " B failed (" + std::to_string(cl_env->cl_status) + ")");
+    pool.device_bytes += size;
+    return d_mem;
+}
+
+//--carve a slab into slot_size sub-buffers of the given flags
+static void poolCarveSlab(cl_mem_flags flags)
+{
+    BufferPool &pool = cl_env->pool;
+    cl_mem slab = poolCreate(flags, pool.slot_size * POOL_SLAB_SLOTS);
+    pool.slabs.push_back(slab);
+
+    std::vector<cl_mem> &slots = pool.idle[std::make_pair(flags, pool.slot_size)];
+    for (int i = 0; i < POOL_SLAB_SLOTS; i++)
+    {
+        cl_buffer_region region = {i * pool.slot_size, pool.slot_size};
+        cl_mem slot = clCreateSubBuffer(slab, flags, CL_BUFFER_CREATE_TYPE_REGION, &region, &cl_env->cl_status);
+        if (cl_env->cl_status != CL_SUCCESS)
+            throw(string("exception in _clPoolAlloc -> clCreateSubBuffer"));
+        pool.owned[slot] = PooledBuffer{flags, pool.slot_size, true};
+        slots.push_back(slot);
+    }
+}
+
+cl_mem _clPoolAlloc(size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE)
+{
+    BufferPool &pool = cl_env->pool;
+    if (pool.slot_size == 0)
+    {
+        cl_uint align_bits = 0;
+        clGetDeviceInfo(cl_env->devices[cl_env->device_id], CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, NULL);
+        pool.slot_size = std::max<size_t>(align_bits / 8, 128);
+    }
+
+    bool slot = size <= pool.slot_size;
+    size_t size_class = slot ? pool.slot_size : poolClass(size);
+    //--rounding up must not push a buffer that fits past the largest allocation
+    if (!slot && size <= cl_env->max_alloc_size && size_class > cl_env->max_alloc_size)
+        size_class = cl_env->max_alloc_size;
+    std::vector<cl_mem> &free_list = pool.idle[std::make_pair(flags, size_class)];
+
+    if (free_list.empty())
+    {
+        pool.misses++;
+        if (slot)
+            poolCarveSlab(flags);
+        else
+        {
+            cl_mem d_mem = poolCreate(flags, size_class);
+            pool.owned[d_mem] = PooledBuffer{flags, size_class, false};
+            free_list.push_back(d_mem);
+        }
+    }
+    else
+        pool.hits++;
+
+    cl_mem d_mem = free_list.back();
+    free_list.pop_back();
+    pool.used_bytes += size_class;
+    pool.peak_bytes = std::max(pool.peak_bytes, pool.used_bytes);
+    return d_mem;
+}
+
+//--buffers the pool did not create (e.g. zero-copy host buffers) are released
+void _clPoolFree(cl_mem d_mem)
+{
+    if (d_mem == NULL)
+        return;
+
+    BufferPool &pool = cl_env->pool;
+    auto it = pool.owned.find(d_mem);
+    if (it == pool.owned.end())
+    {
+        _clFree(d_mem);
+        return;
+    }
+    pool.used_bytes -= it->second.size;
+    pool.idle[std::make_pair(it->second.flags, it->second.size)].push_back(d_mem);
+}
+
+void _clPoolReport()
+{
+    BufferPool &pool = cl_env->pool;
+    printf("device memory: %0.2f MB in use, %0.2f MB peak, %0.2f MB allocated; pool %lld hits, %lld misses\n",
+           pool.used_bytes / 1048576.0, pool.peak_bytes / 1048576.0, pool.device_bytes / 1048576.0,
+           pool.hits, pool.misses);
+}
+
+//--------------------------------------------------------
+//exclusive prefix sum of n ints from d_in into d_out (may alias), on device.
+//block totals are scanned recursively until they fit in one work group.
+void _clScan(cl_mem d_in, cl_mem d_out, int n)
+{
+    int groups = (n + work_group_size - 1) / work_group_size;
+    cl_mem d_block_sums = _clPoolAlloc(groups * sizeof(int));
+
+    int kernel_idx = 0;
+    _clSetArgs(KERNEL_SCAN_LOCAL, kernel_idx++, d_in);
+    _clSetArgs(KERNEL_SCAN_LOCAL, kernel_idx++, d_out);
+    _clSetArgs(KERNEL_SCAN_LOCAL, kernel_idx++, d_block_sums);
+    _clSetArgs(KERNEL_SCAN_LOCAL, kernel_idx++, &n, sizeof(int));
+    _clSetArgs(KERNEL_SCAN_LOCAL, kernel_idx++, NULL, work_group_size * sizeof(int));
+    clReleaseEvent(_clInvokeKernel(KERNEL_SCAN_LOCAL, n, work_group_size));
+
+    if (groups > 1)
+    {
+        _clScan(d_block_sums, d_block_sums, groups);
+
+        kernel_idx = 0;
+        _clSetArgs(KERNEL_SCAN_ADD, kernel_idx++, d_out);
+        _clSetArgs(KERNEL_SCAN_ADD, kernel_idx++, d_block_sums);
+        _clSetArgs(KERNEL_SCAN_ADD, kernel_idx++, &n, sizeof(int));
+        clReleaseEvent(_clInvokeKernel(KERNEL_SCAN_ADD, n, work_group_size));
+    }
+
+    _clPoolFree(d_block_sums);
+}
+
+//--------------------------------------------------------
+//turn a char mask (is_bitmap = 0) or bitmap (is_bitmap = 1) of n entries into
+//the ascending list of set indices in d_out, with the list length in d_count.
+//d_scratch must hold n ints. Everything stays on device.
+void _clCompact(cl_mem d_mask, int n, int is_bitmap, cl_mem d_scratch, cl_mem d_out, cl_mem d_count)
+{
+    int kernel_idx = 0;
+    _clSetArgs(KERNEL_MASK_TO_FLAGS, kernel_idx++, d_mask);
+    _clSetArgs(KERNEL_MASK_TO_FLAGS, kernel_idx++, &is_bitmap, sizeof(int));
+    _clSetArgs(KERNEL_MASK_TO_FLAGS, kernel_idx++, d_scratch);
+    _clSetArgs(KERNEL_MASK_TO_FLAGS, kernel_idx++, &n, sizeof(int));
+    clReleaseEvent(_clInvokeKernel(KERNEL_MASK_TO_FLAGS, n, work_group_size));
+
+    _clScan(d_scratch, d_scratch, n);
+
+    kernel_idx = 0;
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, d_mask);
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, &is_bitmap, sizeof(int));
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, d_scratch);
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, d_out);
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, d_count);
+    _clSetArgs(KERNEL_COMPACT, kernel_idx++, &n, sizeof(int));
+    clReleaseEvent(_clInvokeKernel(KERNEL_COMPACT, n, work_group_size));
+}
+
 void _clWait(cl_int num_of_events, const cl_event* events)
 {
-    oclHandles.cl_status = clWaitForEvents(num_of_events, events);
+    cl_env->cl_status = clWaitForEvents(num_of_events, events);
 #ifdef ERRMSG
-    oclHandles.error_str = "exception in _clWait() ->";
-    switch(oclHandles.cl_status)
+    cl_env->error_str = "exception in _clWait() ->";
+    switch(cl_env->cl_status)
     {
         case CL_INVALID_VALUE:
-            oclHandles.error_str += "CL_INVALID_VALUE";
+            cl_env->error_str += "CL_INVALID_VALUE";
             break;
         case CL_INVALID_CONTEXT:
-            oclHandles.error_str += "CL_INVALID_CONTEXT";
+            cl_env->error_str += "CL_INVALID_CONTEXT";
             break;
         case CL_INVALID_EVENT:
-            oclHandles.error_str += "CL_INVALID_EVENT";
+            cl_env->error_str += "CL_INVALID_EVENT";
             break;
         case CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST:
-            oclHandles.error_str += "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
+            cl_env->error_str += "CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST";
             break;
         case CL_OUT_OF_RESOURCES:
-            oclHandles.error_str += "CL_OUT_OF_RESOURCES";
+            cl_env->error_str += "CL_OUT_OF_RESOURCES";
             break;
         case CL_OUT_OF_HOST_MEMORY:
-            oclHandles.error_str += "CL_OUT_OF_HOST_MEMORY";
+            cl_env->error_str += "CL_OUT_OF_HOST_MEMORY";
             break;
     }
-    if(oclHandles.cl_status != CL_SUCCESS)
+    if(cl_env->cl_status != CL_SUCCESS)
     {
-        throw(oclHandles.error_str);
+        throw(cl_env->error_str);
     }
 #endif
 }
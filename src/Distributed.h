@@ -0,0 +1,290 @@
+//------------------------------------------
+//--distributed BFS (make mpi; mpirun -np <ranks> ../bin/bfs-mpi <graph>):
+//--the ranks form a rows x cols grid, rank = col * rows + row, and the
+//--vertices are cut into one piece per rank (a whole number of bitmap
+//--words each), rank r owning piece r. A grid column's pieces are one
+//--contiguous vertex range; a grid row's pieces are every rows-th piece.
+//--Rank (row, col) keeps the edges u -> v with u in its column's range and
+//--v in one of its row's pieces, a 2D block of the adjacency matrix.
+//--
+//--Every level:
+//--  column exchange: the owners' frontier pieces are allgathered along
+//--                   the grid column, giving the column's frontier bitmap
+//--  local expansion: PART_EXPAND of the partitioned engine over the block
+//--  row exchange:    the next bitmap's pieces are OR-reduced along the
+//--                   grid row onto their owners (reduce-scatter)
+//--The owners drop visited vertices and set the levels of the rest. Only
+//--bitmap pieces cross process boundaries, never vertex lists or edges.
+//------------------------------------------
+#ifndef _DISTRIBUTED_
+#define _DISTRIBUTED_
+
+#ifdef USE_MPI
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mpi.h>
+
+#include "Engines.h"
+
+struct MpiGrid
+{
+    int rank = 0, ranks = 1;
+    int rows = 1, cols = 1;
+    int row = 0, col = 0;
+    int piece_words = 0;                                         // bitmap words of every piece
+    MPI_Comm row_comm = MPI_COMM_NULL, col_comm = MPI_COMM_NULL; // ordered by col and by row respectively
+
+    //--this rank's block: the column's vertex range, its adjacency cut to
+    //--the row's pieces, edge indices starting at 0
+    int begin = 0, count = 0;
+    std::vector<Node> nodes;
+    std::vector<int> edges;
+};
+
+MpiGrid mpi_grid;
+
+//--MPI and the grid: rows the largest divisor of ranks not above its square
+//--root. Output of all ranks but 0 goes to /dev/null.
+void mpiInit(int *argc, char ***argv)
+{
+    MPI_Init(argc, argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_grid.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_grid.ranks);
+
+    mpi_grid.rows = (int)std::sqrt((double)mpi_grid.ranks);
+    while (mpi_grid.ranks % mpi_grid.rows != 0)
+        mpi_grid.rows--;
+    mpi_grid.cols = mpi_grid.ranks / mpi_grid.rows;
+    mpi_grid.row = mpi_grid.rank % mpi_grid.rows;
+    mpi_grid.col = mpi_grid.rank / mpi_grid.rows;
+    MPI_Comm_split(MPI_COMM_WORLD, mpi_grid.row, mpi_grid.col, &mpi_grid.row_comm);
+    MPI_Comm_split(MPI_COMM_WORLD, mpi_grid.col, mpi_grid.row, &mpi_grid.col_comm);
+
+    if (mpi_grid.rank > 0 && !freopen("/dev/null", "w", stdout))
+        throw(string("mpiInit()::Error: Unable to silence rank ") + std::to_string(mpi_grid.rank));
+}
+
+void mpiFinalize()
+{
+    if (mpi_grid.row_comm != MPI_COMM_NULL)
+    {
+        MPI_Comm_free(&mpi_grid.row_comm);
+        MPI_Comm_free(&mpi_grid.col_comm);
+    }
+    MPI_Finalize();
+}
+
+//--cut this rank's block out of the graph
+void mpiDistribute(int no_of_nodes, const Node *h_nodes, const int *h_edges)
+{
+    int words = (no_of_nodes + 31) / 32;
+    mpi_grid.piece_words = (words + mpi_grid.ranks - 1) / mpi_grid.ranks;
+    int piece_nodes = mpi_grid.piece_words * 32;
+
+    int column_nodes = mpi_grid.rows * piece_nodes;
+    mpi_grid.begin = std::min(mpi_grid.col * column_nodes, no_of_nodes);
+    mpi_grid.count = std::min(mpi_grid.begin + column_nodes, no_of_nodes) - mpi_grid.begin;
+
+    mpi_grid.nodes.resize(mpi_grid.count);
+    mpi_grid.edges.clear();
+    for (int i = 0; i < mpi_grid.count; i++)
+    {
+        const Node &node = h_nodes[mpi_grid.begin + i];
+        mpi_grid.nodes[i].starting = mpi_grid.edges.size();
+        for (int e = node.starting; e < node.starting + node.no_of_edges; e++)
+            if (h_edges[e] / piece_nodes % mpi_grid.rows == mpi_grid.row)
+                mpi_grid.edges.push_back(h_edges[e]);
+        mpi_grid.nodes[i].no_of_edges = mpi_grid.edges.size() - mpi_grid.nodes[i].starting;
+    }
+
+    //--one copy of every output file, from rank 0
+    if (mpi_grid.rank > 0)
+    {
+        level_trace_file.clear();
+        tracing = false;
+        bench_format = BENCH_OFF;
+    }
+
+    long long local_edges = mpi_grid.edges.size(), max_edges;
+    MPI_Reduce(&local_edges, &max_edges, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    printf("MPI: %d ranks in a %d x %d grid, at most %lld edges per rank\n", mpi_grid.ranks, mpi_grid.rows, mpi_grid.cols, max_edges);
+}
+
+//----------------------------------------------------------
+//--one BFS over the grid; every rank passes the same source and ends up
+//--with the levels of all vertices in h_cost
+//----------------------------------------------------------
+void run_bfs_distributed(int no_of_nodes, int *h_cost, int source)
+{
+    MpiGrid &grid = mpi_grid;
+    int pw = grid.piece_words;
+    int piece_nodes = pw * 32;
+    int words = grid.ranks * pw; // device bitmaps cover every piece
+    int edge_count = grid.edges.size();
+
+    //--the pieces this rank owns
+    std::vector<cl_uint> own_frontier(pw, 0), own_visited(pw, 0), own_next(pw);
+    std::vector<int> own_cost(piece_nodes, -1);
+    if (source / piece_nodes == grid.rank)
+    {
+        int v = source - grid.rank * piece_nodes;
+        own_frontier[v >> 5] = own_visited[v >> 5] = 1u << (v & 31);
+        own_cost[v] = 0;
+    }
+
+    std::vector<cl_uint> h_frontier(words, 0), h_next(words), send(grid.cols * pw);
+    cl_mem d_nodes, d_edges, d_frontier, d_visited, d_next, d_cost;
+    cl_ulong timers[3] = {0, 0, 0};
+    double exchange = 0;
+    int level = 0;
+    long long h_frontier_size = 1;
+
+    try
+    {
+        //--1 the block, nothing visited yet (h_frontier is still empty)
+        cl_event h2dpreevents[4];
+        int h2dcount = 0;
+        d_nodes = createDeviceArray(std::max(grid.count, 1) * sizeof(Node), grid.nodes.data(), h2dpreevents, &h2dcount);
+        d_edges = createDeviceArray(std::max(edge_count, 1) * sizeof(int), grid.edges.data(), h2dpreevents, &h2dcount);
+        d_frontier = createDeviceState(words * sizeof(cl_uint));
+        d_visited = createDeviceState(words * sizeof(cl_uint));
+        d_next = createDeviceState(words * sizeof(cl_uint));
+        d_cost = createDeviceState(sizeof(int)); // levels stay with the owners
+        h2dpreevents[h2dcount++] = writeDeviceArray(d_visited, words * sizeof(cl_uint), h_frontier.data());
+        waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+        for (int i = 0; i < h2dcount; i++)
+            clReleaseEvent(h2dpreevents[i]);
+
+        //--2 levels
+        int zero = 0;
+        cl_event h2devents[1], kernelevents[2], d2hevents[1];
+        string kernelstrings[2];
+        for (;;)
+        {
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "distributed", "bitmap", profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+
+            //--column exchange
+            double start = MPI_Wtime();
+            MPI_Allgather(own_frontier.data(), pw, MPI_UNSIGNED, h_frontier.data() + grid.col * grid.rows * pw, pw, MPI_UNSIGNED,
+                          grid.col_comm);
+            exchange += MPI_Wtime() - start;
+
+            //--local expansion: visited |= frontier and next = 0, then expand
+            h2devents[0] = writeDeviceArray(d_frontier, words * sizeof(cl_uint), h_frontier.data());
+
+            int kernel_id = KERNEL_PART_UPDATE;
+            int kernel_idx = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_visited);
+            _clSetArgs(kernel_id, kernel_idx++, d_next);
+            _clSetArgs(kernel_id, kernel_idx++, d_cost);
+            _clSetArgs(kernel_id, kernel_idx++, &grid.begin, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &zero, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &words, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+            perfStart("opencl kernels");
+            kernelevents[0] = _clInvokeKernel(kernel_id, words, work_group_size, 1, h2devents);
+
+            kernel_id = KERNEL_PART_EXPAND;
+            kernel_idx = 0;
+            int edge_base = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+            _clSetArgs(kernel_id, kernel_idx++, d_edges);
+            _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_visited);
+            _clSetArgs(kernel_id, kernel_idx++, d_next);
+            _clSetArgs(kernel_id, kernel_idx++, &grid.begin, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &grid.count, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &edge_base, sizeof(int));
+            kernelevents[1] = _clInvokeKernel(kernel_id, std::max(grid.count, 1), work_group_size, 1, &kernelevents[0]);
+            perfKernelDone(kernelevents[1]);
+            kernelstrings[0] = "Distributed update at level " + std::to_string(level);
+            kernelstrings[1] = "Distributed expand at level " + std::to_string(level);
+
+            d2hevents[0] = readDeviceArray(d_next, words * sizeof(cl_uint), h_next.data());
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            waitAndTime(2, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(h2devents[0]);
+            clReleaseEvent(kernelevents[0]);
+            clReleaseEvent(kernelevents[1]);
+            clReleaseEvent(d2hevents[0]);
+
+            //--edges the block inspected at this level
+            long long totals[2] = {0, 0};
+            for (int i = 0; i < grid.count; i += 32)
+                for (cl_uint b = h_frontier[(grid.begin + i) >> 5]; b; b &= b - 1)
+                    totals[1] += grid.nodes[i + __builtin_ctz(b)].no_of_edges;
+
+            //--row exchange: piece j of the row goes to the rank in grid column j
+            for (int j = 0; j < grid.cols; j++)
+                memcpy(&send[j * pw], &h_next[(j * grid.rows + grid.row) * pw], pw * sizeof(cl_uint));
+            start = MPI_Wtime();
+            MPI_Reduce_scatter_block(send.data(), own_next.data(), pw, MPI_UNSIGNED, MPI_BOR, grid.row_comm);
+            exchange += MPI_Wtime() - start;
+
+            //--the owner settles its piece
+            for (int w = 0; w < pw; w++)
+            {
+                cl_uint bits = own_next[w] & ~own_visited[w];
+                own_frontier[w] = bits;
+                own_visited[w] |= bits;
+                totals[0] += __builtin_popcount(bits);
+                for (; bits; bits &= bits - 1)
+                    own_cost[w * 32 + __builtin_ctz(bits)] = level + 1;
+            }
+
+            start = MPI_Wtime();
+            MPI_Allreduce(MPI_IN_PLACE, totals, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+            exchange += MPI_Wtime() - start;
+            if (record >= 0)
+            {
+                LevelStats &stats = level_stats[record];
+                stats.frontier_size = h_frontier_size;
+                stats.edges = totals[1];
+                stats.discovered = totals[0];
+            }
+            h_frontier_size = totals[0];
+            if (h_frontier_size == 0)
+                break;
+            level++;
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops on %d ranks, %0.3f ms in exchanges on rank 0\n", level + 1, grid.ranks, exchange * 1000);
+#endif
+
+        //--3 every piece's levels to every rank
+        std::vector<int> all_cost(grid.ranks * piece_nodes);
+        MPI_Allgather(own_cost.data(), piece_nodes, MPI_INT, all_cost.data(), piece_nodes, MPI_INT, MPI_COMM_WORLD);
+        memcpy(h_cost, all_cost.data(), no_of_nodes * sizeof(int));
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_distributed -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_nodes);
+    _clPoolFree(d_edges);
+    _clPoolFree(d_frontier);
+    _clPoolFree(d_visited);
+    _clPoolFree(d_next);
+    _clPoolFree(d_cost);
+    profileFlush();
+
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+#endif // USE_MPI
+
+#endif //_DISTRIBUTED_
@@ -0,0 +1,1832 @@
+//------------------------------------------
+//--BFS engines: the sequential reference and the OpenCL traversals. Each
+//--runs on the calling thread's OpenCL environment (cl_env).
+//------------------------------------------
+#ifndef _ENGINES_
+#define _ENGINES_
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <ctime>
+#include <climits>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "CLHelper.h"
+#include "util.h"
+#include "Graph.h"
+#include "LevelTrace.h"
+#include "Profile.h"
+#include "PerfCounters.h"
+#include "Numa.h"
+
+#define LOCAL_QUEUE_SIZE 1024 // ints per work-group in BFS_QUEUE's __local queue
+
+typedef unsigned long long timestamp_t;
+
+static timestamp_t get_timestamp ()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return  now.tv_nsec / 1000 + (timestamp_t)now.tv_sec * 1000000;
+}
+
+//----------------------------------------------------------
+//--Reference bfs on cpu
+//--programmer:	jianbin
+//--date:	26/01/2011
+//--note: width is changed to the new_width
+//----------------------------------------------------------
+void run_bfs_cpu(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, char* h_mask, char* h_new_mask, char* h_visited, int *h_cost_ref)
+{
+    timestamp_t t0 = profile_mode != PROFILE_OFF ? get_timestamp() : 0;
+
+    int amtloops = 0;
+    char shouldContinue;
+    do
+    {
+        amtloops++;
+        shouldContinue = false;
+        for (int tid = 0; tid < no_of_nodes; tid++)
+        {
+            if (h_mask[tid])
+            {
+                h_mask[tid] = false;
+                for (int i = h_nodes[tid].starting; i < h_nodes[tid].starting + h_nodes[tid].no_of_edges; i++)
+                {
+                    int id = h_edges[i]; //--cambine: node id is connected with node tid
+                    if (!h_visited[id])
+                    {
+                        h_cost_ref[id] = h_cost_ref[tid] + 1;
+                        h_new_mask[id] = true;
+                    }
+                }
+            }
+        }
+
+        for (int tid = 0; tid < no_of_nodes; tid++)
+        {
+            if (h_new_mask[tid] == true)
+            {
+                h_mask[tid] = true;
+                h_visited[tid] = true;
+                shouldContinue = true;
+                h_new_mask[tid] = false;
+            }
+        }
+    } while (shouldContinue);
+
+#ifdef VERBOSE
+    printf("Took %d loops\n", amtloops);
+#endif
+    if (profile_mode != PROFILE_OFF)
+    {
+        timestamp_t t1 = get_timestamp();
+        double secs = (t1 - t0) / 1000.0L;
+        std::cout << "\treference time (sequential)(ms):" << secs << std::endl;
+    }
+}
+
+//--a BFS tree from the levels of a traversal: any neighbour one level up
+//--is a valid parent. The source is its own parent, unreached vertices -1.
+void bfsParents(int no_of_nodes, const Node *h_nodes, const int *h_edges, const int *h_cost, int source, int *h_parents)
+{
+    for (int v = 0; v < no_of_nodes; v++)
+        h_parents[v] = -1;
+    h_parents[source] = source;
+    for (int u = 0; u < no_of_nodes; u++)
+    {
+        int level = h_cost[u];
+        if (level < 0)
+            continue;
+        for (int i = h_nodes[u].starting; i < h_nodes[u].starting + h_nodes[u].no_of_edges; i++)
+        {
+            int v = h_edges[i];
+            if (h_cost[v] == level + 1 && h_parents[v] < 0)
+                h_parents[v] = u;
+        }
+    }
+}
+
+//----------------------------------------------------------
+//--device views of host arrays. In zero-copy mode a buffer aliases the host
+//--array and is accessed through map/unmap instead of H2D/D2H copies.
+//--Device buffers come from the environment's pool; release with _clPoolFree.
+//----------------------------------------------------------
+cl_mem createDeviceArray(int size, void *h_mem, cl_event *events, int *count)
+{
+    if (cl_env->zero_copy)
+        return _clMallocHost(size, h_mem);
+
+    cl_mem d_mem = _clPoolAlloc(size);
+    events[(*count)++] = _clMemcpyH2D(d_mem, size, h_mem);
+    return d_mem;
+}
+
+//--small buffers the host reads or writes every level
+cl_mem createDeviceState(int size)
+{
+    return _clPoolAlloc(size, cl_env->zero_copy ? CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR : CL_MEM_READ_WRITE);
+}
+
+cl_event writeDeviceArray(cl_mem d_mem, int size, const void *h_mem)
+{
+    if (!cl_env->zero_copy)
+        return _clMemcpyH2D(d_mem, size, h_mem);
+
+    void *mapped = _clMap(d_mem, size, CL_MAP_WRITE, NULL);
+    if (mapped != h_mem)
+        memcpy(mapped, h_mem, size);
+    return _clUnmap(d_mem, mapped);
+}
+
+cl_event readDeviceArray(cl_mem d_mem, int size, void *h_mem)
+{
+    if (!cl_env->zero_copy)
+        return _clMemcpyD2H(d_mem, size, h_mem);
+
+    cl_event event;
+    void *mapped = _clMap(d_mem, size, CL_MAP_READ, &event);
+    if (mapped != h_mem)
+        memcpy(h_mem, mapped, size);
+    clReleaseEvent(_clUnmap(d_mem, mapped));
+    return event;
+}
+
+//----------------------------------------------------------
+//--edge array upload in chunks on the transfer queue, so traversal can start
+//--before the whole graph is resident. The queue is in-order: once chunk i
+//--has completed, every edge before it has as well.
+//--With more than one chunk, kernels read d_edges while the transfer queue
+//--still writes later chunks of it. OpenCL 1.2 leaves concurrent access to
+//--one memory object (or its sub-buffers) undefined, so this relies on the
+//--implementation and only happens with --upload-chunk; by default the edges
+//--are one chunk that the first kernel waits for.
+//----------------------------------------------------------
+struct EdgeUpload
+{
+    int chunk_edges;
+    int no_of_chunks; // 0 in zero-copy mode
+    int resident;     // chunks [0, resident) are covered by an earlier wait
+    cl_event *events;
+};
+
+cl_mem createEdgeArray(int no_of_edges, int *h_edges, EdgeUpload *upload)
+{
+    upload->no_of_chunks = 0;
+    upload->resident = 0;
+    upload->events = NULL;
+
+    if (cl_env->zero_copy)
+        return _clMallocHost(no_of_edges * sizeof(int), h_edges);
+
+    cl_mem d_edges = _clPoolAlloc(no_of_edges * sizeof(int));
+
+    upload->chunk_edges = upload_chunk_bytes ? upload_chunk_bytes / sizeof(int) : no_of_edges;
+    if (upload->chunk_edges < 1)
+        upload->chunk_edges = 1;
+    upload->no_of_chunks = (no_of_edges + upload->chunk_edges - 1) / upload->chunk_edges;
+    upload->events = (cl_event *)malloc(upload->no_of_chunks * sizeof(cl_event));
+
+    for (int i = 0; i < upload->no_of_chunks; i++)
+    {
+        int first = i * upload->chunk_edges;
+        int count = std::min(upload->chunk_edges, no_of_edges - first);
+        upload->events[i] = _clMemcpyH2DAsync(d_edges, first * sizeof(int), count * sizeof(int), h_edges + first);
+    }
+    clFlush(cl_env->transfer_queue);
+
+    return d_edges;
+}
+
+//--fill wait_list with the upload a kernel touching edges [0, edge_end) has
+//--to wait for. Returns the number of events (0 or 1).
+int edgeWaitList(EdgeUpload *upload, int edge_end, cl_event *wait_list)
+{
+    if (upload->no_of_chunks == 0 || edge_end <= 0)
+        return 0;
+
+    int last = std::min((edge_end - 1) / upload->chunk_edges, upload->no_of_chunks - 1);
+    if (last < upload->resident)
+        return 0;
+
+    wait_list[0] = upload->events[last];
+    upload->resident = last + 1;
+    return 1;
+}
+
+void finishEdgeUpload(EdgeUpload *upload)
+{
+    if (upload->no_of_chunks == 0)
+        return;
+
+    _clWait(upload->no_of_chunks, upload->events);
+    for (int i = 0; i < upload->no_of_chunks; i++)
+        clReleaseEvent(upload->events[i]);
+    free(upload->events);
+    upload->no_of_chunks = 0;
+}
+
+//--end of a counted kernel: on a CPU device the kernel runs on the runtime's
+//--worker threads, so counting stops only once it has completed
+void perfKernelDone(cl_event event)
+{
+    if (!perf_counters)
+        return;
+    _clWait(1, &event);
+    perfStop("opencl kernels");
+}
+
+//--vertex ranges with a NUMA sub-device each (--numa), 0 if the device
+//--was not split
+int numaParts()
+{
+    return numa_bounds.size() == cl_env->node_queues.size() + 1 ? cl_env->node_queues.size() : 0;
+}
+
+//--run a kernel over all vertices, each NUMA range on its node's queue.
+//--end_arg is the kernel's vertex count argument, set to the range's end.
+//--Returns once every range has completed.
+void invokeNuma(int kernel_id, int end_arg, int waitcount, const cl_event *waitlist, cl_ulong *timers)
+{
+    //--the node queues do not see the main queue's order
+    _clFinish();
+
+    std::vector<cl_event> events;
+    std::vector<string> strings;
+    perfStart("opencl kernels");
+    for (int part = 0; part < numaParts(); part++)
+    {
+        int begin = numa_bounds[part], end = numa_bounds[part + 1];
+        if (begin == end)
+            continue;
+        _clSetArgs(kernel_id, end_arg, &end, sizeof(int));
+        events.push_back(_clInvokeKernelOn(cl_env->node_queues[part], kernel_id, begin, end - begin, work_group_size, waitcount, waitlist));
+        strings.push_back(kernel_names[kernel_id] + " on NUMA node " + std::to_string(numa_nodes[part].id));
+    }
+    _clWait(events.size(), events.data());
+    perfStop("opencl kernels");
+
+    waitAndTime(events.size(), events.data(), PROFILE_KERNEL, timers, strings.data());
+    for (size_t i = 0; i < events.size(); i++)
+        clReleaseEvent(events[i]);
+}
+
+//----------------------------------------------------------
+//--breadth first search on the OpenCL device
+//----------------------------------------------------------
+//--compressed: h_nodes and h_edges come from compressCsr, no_of_edges is the
+//--length of the byte array in ints
+void run_bfs_opencl(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, char *h_mask, char *h_new_mask, char *h_visited, int *h_cost,
+                    bool compressed = false)
+{
+    char h_done = true;
+    int h_stats[2];
+    cl_mem d_nodes, d_edges, d_mask, d_new_mask, d_visited, d_cost, d_done, d_stats = NULL;
+
+    cl_ulong timers[3] = {0, 0, 0};
+
+    try
+    {
+        //--1 transfer data from host to device
+        cl_event h2dpreevents[6];
+        int h2dcount = 0;
+        EdgeUpload upload;
+        d_nodes = createDeviceArray(no_of_nodes * sizeof(Node), h_nodes, h2dpreevents, &h2dcount);
+        d_edges = createEdgeArray(no_of_edges, h_edges, &upload);
+        d_mask = createDeviceArray(no_of_nodes * sizeof(char), h_mask, h2dpreevents, &h2dcount);
+        d_new_mask = createDeviceArray(no_of_nodes * sizeof(char), h_new_mask, h2dpreevents, &h2dcount);
+        d_visited = createDeviceArray(no_of_nodes * sizeof(char), h_visited, h2dpreevents, &h2dcount);
+
+        d_cost = createDeviceArray(no_of_nodes * sizeof(int), h_cost, h2dpreevents, &h2dcount);
+        d_done = createDeviceState(sizeof(char));
+        if (!level_trace_file.empty())
+            d_stats = createDeviceState(2 * sizeof(int));
+
+        waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+        //--2 invoke kernel
+        int amtloops = 0;
+
+        cl_event h2devents[1];
+        cl_event kernelevents[1];
+        string kernelstrings[1];
+        cl_event d2hevents[1];
+        do
+        {
+            amtloops++;
+            int record = d_stats ? beginLevelStats(amtloops - 1, "mask", "mask", profile_mode != PROFILE_OFF) : -1;
+            profile_level_record = record;
+
+            if (d_stats)
+            {
+                h_stats[0] = h_stats[1] = 0;
+                clReleaseEvent(writeDeviceArray(d_stats, 2 * sizeof(int), h_stats));
+            }
+
+            h_done = true; 
+            h2devents[0] = writeDeviceArray(d_done, sizeof(char), &h_done);
+
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            clReleaseEvent(h2devents[0]);
+
+            //--kernel 0
+            int kernel_id = compressed ? KERNEL_BFS_COMPRESSED : KERNEL_BFS_1;
+            int kernel_idx = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+            _clSetArgs(kernel_id, kernel_idx++, d_edges);
+            _clSetArgs(kernel_id, kernel_idx++, d_mask);
+            _clSetArgs(kernel_id, kernel_idx++, d_new_mask);
+            _clSetArgs(kernel_id, kernel_idx++, d_visited);
+            _clSetArgs(kernel_id, kernel_idx++, d_cost);
+            _clSetArgs(kernel_id, kernel_idx++, d_done);
+            _clSetArgs(kernel_id, kernel_idx++, &no_of_nodes, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, d_stats);
+
+            //int work_items = no_of_nodes;
+            kernelstrings[0] = "Top_Down cycle w/ size: unknown"; 
+            //--the frontier is not known on the host: wait for the whole graph
+            cl_event waitlist[1];
+            int waitcount = edgeWaitList(&upload, no_of_edges, waitlist);
+            if (numaParts() > 0)
+                invokeNuma(kernel_id, 7, waitcount, waitlist, timers);
+            else
+            {
+                perfStart("opencl kernels");
+                kernelevents[0] = _clInvokeKernel(kernel_id, no_of_nodes, work_group_size, waitcount, waitlist);
+                perfKernelDone(kernelevents[0]);
+                waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+                clReleaseEvent(kernelevents[0]);
+            }
+
+            d2hevents[0] = readDeviceArray(d_done, sizeof(char), &h_done);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+
+            if (d_stats)
+            {
+                clReleaseEvent(readDeviceArray(d_stats, 2 * sizeof(int), h_stats));
+
+                LevelStats &stats = level_stats[record];
+                stats.frontier_size = h_stats[0];
+                stats.edges = h_stats[1];
+            }
+            
+            cl_mem tmp = d_mask;
+            d_mask = d_new_mask;
+            d_new_mask = tmp;
+        } while (!h_done);
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops\n", amtloops);
+#endif
+        _clFinish();
+        waitAndTime(upload.no_of_chunks, upload.events, PROFILE_H2D, timers);
+        finishEdgeUpload(&upload);
+
+        //--3 transfer data from device to host
+        cl_event d2hevent[1];
+        d2hevent[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+
+        waitAndTime(1, d2hevent, PROFILE_D2H, timers);
+        clReleaseEvent(d2hevent[0]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_opencl -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_nodes);
+    _clPoolFree(d_edges);
+    _clPoolFree(d_mask);
+    _clPoolFree(d_new_mask);
+    _clPoolFree(d_visited);
+    _clPoolFree(d_cost);
+    _clPoolFree(d_done);
+    if (d_stats)
+        _clPoolFree(d_stats);
+
+    profileFlush();
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--breadth first search on the OpenCL device, frontier kept as a vertex queue
+//----------------------------------------------------------
+void run_bfs_opencl_queue(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int *h_cost, int source)
+{
+    int h_frontier_size = 1;
+    int h_frontier_edges = h_nodes[source].no_of_edges;
+    int h_edge_end = h_nodes[source].starting + h_nodes[source].no_of_edges;
+    cl_mem d_nodes, d_edges, d_frontier, d_next_frontier, d_counters, d_cost;
+
+    cl_ulong timers[3] = {0, 0, 0};
+
+    try
+    {
+        //--1 transfer data from host to device
+        cl_event h2dpreevents[4];
+        int h2dcount = 0;
+        EdgeUpload upload;
+        d_nodes = createDeviceArray(no_of_nodes * sizeof(Node), h_nodes, h2dpreevents, &h2dcount);
+        d_edges = createEdgeArray(no_of_edges, h_edges, &upload);
+        d_frontier = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_next_frontier = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_counters = createDeviceState(3 * sizeof(int));
+        d_cost = createDeviceArray(no_of_nodes * sizeof(int), h_cost, h2dpreevents, &h2dcount);
+        h2dpreevents[h2dcount++] = writeDeviceArray(d_frontier, sizeof(int), &source);
+
+        waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+        for (int i = 0; i < h2dcount; i++)
+            clReleaseEvent(h2dpreevents[i]);
+
+        //--2 invoke kernel
+        int level = 0;
+        int local_capacity = LOCAL_QUEUE_SIZE;
+
+        cl_event h2devents[1];
+        cl_event kernelevents[1];
+        string kernelstrings[1];
+        cl_event d2hevents[1];
+        while (h_frontier_size > 0)
+        {
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "queue", "queue", profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+
+            int h_counters[3] = {0, 0, 0};
+            h2devents[0] = writeDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            clReleaseEvent(h2devents[0]);
+
+            int kernel_id = KERNEL_BFS_QUEUE;
+            int kernel_idx = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+            _clSetArgs(kernel_id, kernel_idx++, d_edges);
+            _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_next_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_counters);
+            _clSetArgs(kernel_id, kernel_idx++, d_cost);
+            _clSetArgs(kernel_id, kernel_idx++, &h_frontier_size, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, NULL, local_capacity * sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &local_capacity, sizeof(int));
+
+            kernelstrings[0] = "Queue cycle w/ size: " + std::to_string(h_frontier_size);
+            cl_event waitlist[1];
+            int waitcount = edgeWaitList(&upload, h_edge_end, waitlist);
+            perfStart("opencl kernels");
+            kernelevents[0] = _clInvokeKernel(kernel_id, h_frontier_size, work_group_size, waitcount, waitlist);
+            perfKernelDone(kernelevents[0]);
+            waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            clReleaseEvent(kernelevents[0]);
+
+            d2hevents[0] = readDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+
+            if (record >= 0)
+            {
+                LevelStats &stats = level_stats[record];
+                stats.frontier_size = h_frontier_size;
+                stats.edges = h_frontier_edges;
+                stats.discovered = h_counters[0];
+            }
+
+            h_frontier_size = h_counters[0];
+            h_frontier_edges = h_counters[1];
+            h_edge_end = h_counters[2];
+
+            cl_mem tmp = d_frontier;
+            d_frontier = d_next_frontier;
+            d_next_frontier = tmp;
+            level++;
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops\n", level);
+#endif
+        _clFinish();
+        waitAndTime(upload.no_of_chunks, upload.events, PROFILE_H2D, timers);
+        finishEdgeUpload(&upload);
+
+        //--3 transfer data from device to host
+        cl_event d2hevent[1];
+        d2hevent[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+
+        waitAndTime(1, d2hevent, PROFILE_D2H, timers);
+        clReleaseEvent(d2hevent[0]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_opencl_queue -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_nodes);
+    _clPoolFree(d_edges);
+    _clPoolFree(d_frontier);
+    _clPoolFree(d_next_frontier);
+    _clPoolFree(d_counters);
+    _clPoolFree(d_cost);
+
+    profileFlush();
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--breadth first search on the OpenCL device, switching the frontier between
+//--a vertex queue (small frontiers) and a bitmap (large frontiers) per level
+//----------------------------------------------------------
+void run_bfs_opencl_adaptive(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int *h_cost, int source)
+{
+    int h_frontier_size = 1;
+    int h_frontier_edges = h_nodes[source].no_of_edges;
+    int h_edge_end = h_nodes[source].starting + h_nodes[source].no_of_edges;
+    int bitmap_words = (no_of_nodes + 31) / 32;
+    bool dense = false;
+    cl_mem d_nodes, d_edges, d_queue, d_next_queue, d_bitmap, d_next_bitmap, d_scratch, d_counters, d_cost;
+
+    cl_ulong timers[3] = {0, 0, 0};
+
+    try
+    {
+        //--1 transfer data from host to device
+        cl_event h2dpreevents[4];
+        int h2dcount = 0;
+        EdgeUpload upload;
+        d_nodes = createDeviceArray(no_of_nodes * sizeof(Node), h_nodes, h2dpreevents, &h2dcount);
+        d_edges = createEdgeArray(no_of_edges, h_edges, &upload);
+        d_queue = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_next_queue = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_bitmap = _clPoolAlloc(bitmap_words * sizeof(cl_uint));
+        d_next_bitmap = _clPoolAlloc(bitmap_words * sizeof(cl_uint));
+        d_scratch = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_counters = createDeviceState(3 * sizeof(int));
+        d_cost = createDeviceArray(no_of_nodes * sizeof(int), h_cost, h2dpreevents, &h2dcount);
+        h2dpreevents[h2dcount++] = writeDeviceArray(d_queue, sizeof(int), &source);
+
+        waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+        for (int i = 0; i < h2dcount; i++)
+            clReleaseEvent(h2dpreevents[i]);
+
+        //--2 invoke kernel
+        int level = 0;
+        int local_capacity = LOCAL_QUEUE_SIZE;
+
+        cl_event h2devents[1];
+        cl_event kernelevents[1];
+        string kernelstrings[1];
+        cl_event d2hevents[1];
+        while (h_frontier_size > 0)
+        {
+#ifdef VERBOSE
+            printf("Level %d: %s frontier of %d vertices, %d edges\n", level, dense ? "bitmap" : "queue", h_frontier_size, h_frontier_edges);
+#endif
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "adaptive", dense ? "bitmap" : "queue", profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+
+            int h_counters[3] = {0, 0, 0};
+            h2devents[0] = writeDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            clReleaseEvent(h2devents[0]);
+
+            cl_event waitlist[1];
+            int waitcount = edgeWaitList(&upload, h_edge_end, waitlist);
+            perfStart("opencl kernels");
+
+            int kernel_idx = 0;
+            if (dense)
+            {
+                clReleaseEvent(_clMemset(d_next_bitmap, 0, bitmap_words * sizeof(cl_uint)));
+
+                int kernel_id = KERNEL_BFS_BITMAP;
+                _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+                _clSetArgs(kernel_id, kernel_idx++, d_edges);
+                _clSetArgs(kernel_id, kernel_idx++, d_bitmap);
+                _clSetArgs(kernel_id, kernel_idx++, d_next_bitmap);
+                _clSetArgs(kernel_id, kernel_idx++, d_counters);
+                _clSetArgs(kernel_id, kernel_idx++, d_cost);
+                _clSetArgs(kernel_id, kernel_idx++, &no_of_nodes, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+
+                kernelstrings[0] = "Bitmap cycle w/ size: " + std::to_string(h_frontier_size);
+                kernelevents[0] = _clInvokeKernel(kernel_id, no_of_nodes, work_group_size, waitcount, waitlist);
+
+                cl_mem tmp = d_bitmap;
+                d_bitmap = d_next_bitmap;
+                d_next_bitmap = tmp;
+            }
+            else
+            {
+                int kernel_id = KERNEL_BFS_QUEUE;
+                _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+                _clSetArgs(kernel_id, kernel_idx++, d_edges);
+                _clSetArgs(kernel_id, kernel_idx++, d_queue);
+                _clSetArgs(kernel_id, kernel_idx++, d_next_queue);
+                _clSetArgs(kernel_id, kernel_idx++, d_counters);
+                _clSetArgs(kernel_id, kernel_idx++, d_cost);
+                _clSetArgs(kernel_id, kernel_idx++, &h_frontier_size, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, NULL, local_capacity * sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &local_capacity, sizeof(int));
+
+                kernelstrings[0] = "Queue cycle w/ size: " + std::to_string(h_frontier_size);
+                kernelevents[0] = _clInvokeKernel(kernel_id, h_frontier_size, work_group_size, waitcount, waitlist);
+
+                cl_mem tmp = d_queue;
+                d_queue = d_next_queue;
+                d_next_queue = tmp;
+            }
+            perfKernelDone(kernelevents[0]);
+            waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            clReleaseEvent(kernelevents[0]);
+
+            d2hevents[0] = readDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+
+            if (record >= 0)
+            {
+                LevelStats &stats = level_stats[record];
+                stats.frontier_size = h_frontier_size;
+                stats.edges = h_frontier_edges;
+                stats.discovered = h_counters[0];
+            }
+
+            h_frontier_size = h_counters[0];
+            h_frontier_edges = h_counters[1];
+            h_edge_end = h_counters[2];
+            level++;
+
+            if (h_frontier_size == 0)
+                break;
+
+            //--switch representation for the next level if it pays off
+            if (!dense && h_frontier_edges > no_of_edges / to_dense_divisor)
+            {
+                clReleaseEvent(_clMemset(d_bitmap, 0, bitmap_words * sizeof(cl_uint)));
+
+                int kernel_id = KERNEL_QUEUE_TO_BITMAP;
+                kernel_idx = 0;
+                _clSetArgs(kernel_id, kernel_idx++, d_queue);
+                _clSetArgs(kernel_id, kernel_idx++, d_bitmap);
+                _clSetArgs(kernel_id, kernel_idx++, &h_frontier_size, sizeof(int));
+                clReleaseEvent(_clInvokeKernel(kernel_id, h_frontier_size, work_group_size));
+                dense = true;
+            }
+            else if (dense && h_frontier_size < no_of_nodes / to_sparse_divisor)
+            {
+                _clCompact(d_bitmap, no_of_nodes, 1, d_scratch, d_queue, d_counters);
+                dense = false;
+            }
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops\n", level);
+#endif
+        _clFinish();
+        waitAndTime(upload.no_of_chunks, upload.events, PROFILE_H2D, timers);
+        finishEdgeUpload(&upload);
+
+        //--3 transfer data from device to host
+        cl_event d2hevent[1];
+        d2hevent[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+
+        waitAndTime(1, d2hevent, PROFILE_D2H, timers);
+        clReleaseEvent(d2hevent[0]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_opencl_adaptive -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_nodes);
+    _clPoolFree(d_edges);
+    _clPoolFree(d_queue);
+    _clPoolFree(d_next_queue);
+    _clPoolFree(d_bitmap);
+    _clPoolFree(d_next_bitmap);
+    _clPoolFree(d_scratch);
+    _clPoolFree(d_counters);
+    _clPoolFree(d_cost);
+
+    profileFlush();
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--one top-down level on the host over a vertex queue; visited is cost >= 0.
+//--Returns the out-degree sum of the next frontier.
+//----------------------------------------------------------
+static long long hostQueueLevel(const Node *h_nodes, const int *h_edges, int *h_cost, int level,
+                                const std::vector<int> &frontier, std::vector<int> &next, int *edge_end)
+{
+    long long next_edges = 0;
+    next.clear();
+    *edge_end = 0;
+    for (size_t f = 0; f < frontier.size(); f++)
+    {
+        const Node &node = h_nodes[frontier[f]];
+        for (int i = node.starting; i < node.starting + node.no_of_edges; i++)
+        {
+            int id = h_edges[i];
+            if (h_cost[id] >= 0)
+                continue;
+            h_cost[id] = level + 1;
+            next.push_back(id);
+            next_edges += h_nodes[id].no_of_edges;
+            *edge_end = std::max(*edge_end, h_nodes[id].starting + h_nodes[id].no_of_edges);
+        }
+    }
+    return next_edges;
+}
+
+//----------------------------------------------------------
+//--breadth first search split between host and device: levels whose
+//--frontier has few outgoing edges run on the host, where a level costs no
+//--launch or transfer; the traversal moves to the device (BFS_QUEUE) once the
+//--frontier has more than no_of_edges / to_device_divisor edges and back
+//--below no_of_edges / to_host_divisor. The graph uploads in the background
+//--from the start; a switch moves only the frontier queue and the level
+//--array, which doubles as the visited set.
+//----------------------------------------------------------
+void run_bfs_hybrid(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int *h_cost, int source)
+{
+    std::vector<int> frontier(1, source), next;
+    long long h_frontier_edges = h_nodes[source].no_of_edges;
+    int h_edge_end = h_nodes[source].starting + h_nodes[source].no_of_edges;
+    int h_frontier_size = 1;
+    long long to_device = no_of_edges / std::max(to_device_divisor, 1);
+    long long to_host = no_of_edges / std::max(to_host_divisor, 1);
+    bool on_device = false;
+    int device_levels = 0, switches = 0;
+    cl_mem d_nodes, d_edges, d_frontier, d_next_frontier, d_counters, d_cost;
+
+    cl_ulong timers[3] = {0, 0, 0};
+
+    try
+    {
+        //--1 start the graph upload; the host levels run meanwhile
+        cl_event h2dpreevents[1];
+        int h2dcount = 0;
+        EdgeUpload upload;
+        d_nodes = createDeviceArray(no_of_nodes * sizeof(Node), h_nodes, h2dpreevents, &h2dcount);
+        d_edges = createEdgeArray(no_of_edges, h_edges, &upload);
+        d_frontier = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_next_frontier = _clPoolAlloc(no_of_nodes * sizeof(int));
+        d_counters = createDeviceState(3 * sizeof(int));
+        d_cost = cl_env->zero_copy ? _clMallocHost(no_of_nodes * sizeof(int), h_cost) : _clPoolAlloc(no_of_nodes * sizeof(int));
+        clFlush(cl_env->queue);
+
+        //--2 levels
+        int level = 0;
+        int local_capacity = LOCAL_QUEUE_SIZE;
+
+        cl_event h2devents[2];
+        cl_event kernelevents[1];
+        string kernelstrings[1];
+        cl_event d2hevents[2];
+        while (h_frontier_size > 0)
+        {
+            if (!on_device && h_frontier_edges > to_device)
+            {
+                //--to the device: levels so far and the frontier
+                h2devents[0] = writeDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+                h2devents[1] = writeDeviceArray(d_frontier, h_frontier_size * sizeof(int), frontier.data());
+                waitAndTime(2, h2devents, PROFILE_H2D, timers);
+                clReleaseEvent(h2devents[0]);
+                clReleaseEvent(h2devents[1]);
+                if (h2dcount)
+                {
+                    waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+                    clReleaseEvent(h2dpreevents[0]);
+                    h2dcount = 0;
+                }
+                on_device = true;
+                switches++;
+            }
+            else if (on_device && h_frontier_edges < to_host)
+            {
+                //--back to the host: the levels the device added and the frontier
+                frontier.resize(h_frontier_size);
+                d2hevents[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+                d2hevents[1] = readDeviceArray(d_frontier, h_frontier_size * sizeof(int), frontier.data());
+                waitAndTime(2, d2hevents, PROFILE_D2H, timers);
+                clReleaseEvent(d2hevents[0]);
+                clReleaseEvent(d2hevents[1]);
+                on_device = false;
+                switches++;
+            }
+
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "hybrid", on_device ? "queue" : "host queue",
+                                                                         on_device && profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+            if (record >= 0)
+            {
+                level_stats[record].frontier_size = h_frontier_size;
+                level_stats[record].edges = h_frontier_edges;
+            }
+
+            if (!on_device)
+            {
+                h_frontier_edges = hostQueueLevel(h_nodes, h_edges, h_cost, level, frontier, next, &h_edge_end);
+                frontier.swap(next);
+                h_frontier_size = frontier.size();
+                level++;
+                continue;
+            }
+
+            int h_counters[3] = {0, 0, 0};
+            h2devents[0] = writeDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            clReleaseEvent(h2devents[0]);
+
+            int kernel_id = KERNEL_BFS_QUEUE;
+            int kernel_idx = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_nodes);
+            _clSetArgs(kernel_id, kernel_idx++, d_edges);
+            _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_next_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_counters);
+            _clSetArgs(kernel_id, kernel_idx++, d_cost);
+            _clSetArgs(kernel_id, kernel_idx++, &h_frontier_size, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, NULL, local_capacity * sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &local_capacity, sizeof(int));
+
+            kernelstrings[0] = "Hybrid queue cycle w/ size: " + std::to_string(h_frontier_size);
+            cl_event waitlist[1];
+            int waitcount = edgeWaitList(&upload, h_edge_end, waitlist);
+            perfStart("opencl kernels");
+            kernelevents[0] = _clInvokeKernel(kernel_id, h_frontier_size, work_group_size, waitcount, waitlist);
+            perfKernelDone(kernelevents[0]);
+            waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            clReleaseEvent(kernelevents[0]);
+
+            d2hevents[0] = readDeviceArray(d_counters, 3 * sizeof(int), h_counters);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+
+            h_frontier_size = h_counters[0];
+            h_frontier_edges = h_counters[1];
+            h_edge_end = h_counters[2];
+
+            cl_mem tmp = d_frontier;
+            d_frontier = d_next_frontier;
+            d_next_frontier = tmp;
+            device_levels++;
+            level++;
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops, %d on the device, %d switches\n", level, device_levels, switches);
+#endif
+        _clFinish();
+        if (h2dcount)
+        {
+            waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+            clReleaseEvent(h2dpreevents[0]);
+        }
+        waitAndTime(upload.no_of_chunks, upload.events, PROFILE_H2D, timers);
+        finishEdgeUpload(&upload);
+
+        //--3 the levels the device added last
+        if (on_device)
+        {
+            cl_event d2hevent[1];
+            d2hevent[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+            waitAndTime(1, d2hevent, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevent[0]);
+        }
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_hybrid -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_nodes);
+    _clPoolFree(d_edges);
+    _clPoolFree(d_frontier);
+    _clPoolFree(d_next_frontier);
+    _clPoolFree(d_counters);
+    _clPoolFree(d_cost);
+
+    profileFlush();
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--breadth first search over several devices (one environment each): the
+//--vertices are split into ranges with about the same number of edges and
+//--every device holds only its range's adjacency, so together the devices
+//--can hold a graph none of them could alone. Each level every device
+//--expands its part of the frontier into a next bitmap over all vertices;
+//--the host ORs the bitmaps, drops visited vertices and hands the merged
+//--frontier back to every device.
+//----------------------------------------------------------
+struct DevicePart
+{
+    int begin, count, edge_base;
+    cl_mem d_nodes, d_edges, d_frontier, d_visited, d_next, d_cost;
+    std::vector<cl_uint> h_next;
+};
+
+void run_bfs_partitioned(std::vector<CLEnvironment> &envs, int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges,
+                         int *h_cost, int source)
+{
+    int parts = envs.size();
+    int words = (no_of_nodes + 31) / 32;
+    std::vector<int> bounds;
+    splitByEdges(no_of_nodes, h_nodes, no_of_edges, parts, bounds);
+
+    std::vector<cl_uint> h_frontier(words, 0), h_visited(words, 0);
+    h_frontier[source >> 5] = h_visited[source >> 5] = 1u << (source & 31);
+
+    std::vector<DevicePart> part(parts);
+    cl_ulong timers[3] = {0, 0, 0};
+    int level = 0;
+    int h_frontier_size = 1;
+    long long h_frontier_edges = h_nodes[source].no_of_edges;
+
+    try
+    {
+        //--1 every device gets its range and the source as frontier
+        for (int p = 0; p < parts; p++)
+        {
+            CLBinding binding(envs[p]);
+            DevicePart &dp = part[p];
+            dp.begin = bounds[p];
+            dp.count = bounds[p + 1] - bounds[p];
+            dp.edge_base = dp.count ? h_nodes[dp.begin].starting : 0;
+            int edge_count = dp.count ? h_nodes[bounds[p + 1] - 1].starting + h_nodes[bounds[p + 1] - 1].no_of_edges - dp.edge_base : 0;
+            dp.h_next.assign(words, 0);
+
+            cl_event h2dpreevents[5];
+            int h2dcount = 0;
+            //--empty ranges still need valid buffers
+            dp.d_nodes = createDeviceArray(std::max(dp.count, 1) * sizeof(Node), h_nodes + dp.begin, h2dpreevents, &h2dcount);
+            dp.d_edges = createDeviceArray(std::max(edge_count, 1) * sizeof(int), h_edges + dp.edge_base, h2dpreevents, &h2dcount);
+            dp.d_cost = createDeviceArray(std::max(dp.count, 1) * sizeof(int), h_cost + dp.begin, h2dpreevents, &h2dcount);
+            dp.d_frontier = createDeviceState(words * sizeof(cl_uint));
+            dp.d_visited = createDeviceState(words * sizeof(cl_uint));
+            dp.d_next = createDeviceState(words * sizeof(cl_uint));
+            h2dpreevents[h2dcount++] = writeDeviceArray(dp.d_frontier, words * sizeof(cl_uint), h_frontier.data());
+            waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+            for (int i = 0; i < h2dcount; i++)
+                clReleaseEvent(h2dpreevents[i]);
+
+            cl_event events[2];
+            events[0] = writeDeviceArray(dp.d_visited, words * sizeof(cl_uint), h_visited.data());
+            events[1] = writeDeviceArray(dp.d_next, words * sizeof(cl_uint), dp.h_next.data());
+            waitAndTime(2, events, PROFILE_H2D, timers);
+            clReleaseEvent(events[0]);
+            clReleaseEvent(events[1]);
+        }
+
+        //--2 levels
+        std::vector<cl_event> kernelevents(parts), d2hevents(parts), h2devents(parts);
+        std::vector<string> kernelstrings(parts);
+        for (;;)
+        {
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "partitioned", "bitmap", profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+            if (record >= 0)
+            {
+                level_stats[record].frontier_size = h_frontier_size;
+                level_stats[record].edges = h_frontier_edges;
+            }
+
+            //--expand on every device at once, then fetch the next bitmaps
+            perfStart("opencl kernels");
+            for (int p = 0; p < parts; p++)
+            {
+                CLBinding binding(envs[p]);
+                DevicePart &dp = part[p];
+                int kernel_id = KERNEL_PART_EXPAND;
+                int kernel_idx = 0;
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_nodes);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_edges);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_frontier);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_visited);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_next);
+                _clSetArgs(kernel_id, kernel_idx++, &dp.begin, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &dp.count, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &dp.edge_base, sizeof(int));
+                kernelevents[p] = _clInvokeKernel(kernel_id, std::max(dp.count, 1), work_group_size);
+                kernelstrings[p] = "Partition " + std::to_string(p) + " expand at level " + std::to_string(level);
+                clFlush(cl_env->queue);
+            }
+            for (int p = 0; p < parts; p++)
+            {
+                CLBinding binding(envs[p]);
+                d2hevents[p] = readDeviceArray(part[p].d_next, words * sizeof(cl_uint), part[p].h_next.data());
+            }
+            _clWait(parts, d2hevents.data());
+            perfStop("opencl kernels");
+            waitAndTime(parts, kernelevents.data(), PROFILE_KERNEL, timers, kernelstrings.data());
+            waitAndTime(parts, d2hevents.data(), PROFILE_D2H, timers);
+            for (int p = 0; p < parts; p++)
+            {
+                clReleaseEvent(kernelevents[p]);
+                clReleaseEvent(d2hevents[p]);
+            }
+
+            //--merge
+            h_frontier_size = 0;
+            h_frontier_edges = 0;
+            for (int w = 0; w < words; w++)
+            {
+                cl_uint bits = 0;
+                for (int p = 0; p < parts; p++)
+                    bits |= part[p].h_next[w];
+                bits &= ~h_visited[w];
+                h_frontier[w] = bits;
+                h_visited[w] |= bits;
+                h_frontier_size += __builtin_popcount(bits);
+                if (record >= 0)
+                    for (cl_uint b = bits; b; b &= b - 1)
+                        h_frontier_edges += h_nodes[w * 32 + __builtin_ctz(b)].no_of_edges;
+            }
+            if (record >= 0)
+                level_stats[record].discovered = h_frontier_size;
+            if (h_frontier_size == 0)
+                break;
+
+            //--settle the merged frontier everywhere
+            for (int p = 0; p < parts; p++)
+            {
+                CLBinding binding(envs[p]);
+                DevicePart &dp = part[p];
+                h2devents[p] = writeDeviceArray(dp.d_frontier, words * sizeof(cl_uint), h_frontier.data());
+
+                int kernel_id = KERNEL_PART_UPDATE;
+                int kernel_idx = 0;
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_frontier);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_visited);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_next);
+                _clSetArgs(kernel_id, kernel_idx++, dp.d_cost);
+                _clSetArgs(kernel_id, kernel_idx++, &dp.begin, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &dp.count, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &words, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+                kernelevents[p] = _clInvokeKernel(kernel_id, words, work_group_size, 1, &h2devents[p]);
+                clFlush(cl_env->queue);
+            }
+            _clWait(parts, kernelevents.data());
+            waitAndTime(parts, h2devents.data(), PROFILE_H2D, timers);
+            waitAndTime(parts, kernelevents.data(), PROFILE_KERNEL, timers);
+            for (int p = 0; p < parts; p++)
+            {
+                clReleaseEvent(h2devents[p]);
+                clReleaseEvent(kernelevents[p]);
+            }
+            level++;
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops on %d devices\n", level, parts);
+#endif
+
+        //--3 every range's levels; empty ranges have nothing to read (a
+        //--0 byte read is invalid)
+        int reads = 0;
+        for (int p = 0; p < parts; p++)
+        {
+            if (part[p].count == 0)
+                continue;
+            CLBinding binding(envs[p]);
+            d2hevents[reads++] = readDeviceArray(part[p].d_cost, part[p].count * sizeof(int), h_cost + part[p].begin);
+        }
+        if (reads > 0)
+            _clWait(reads, d2hevents.data());
+        waitAndTime(reads, d2hevents.data(), PROFILE_D2H, timers);
+        for (int i = 0; i < reads; i++)
+            clReleaseEvent(d2hevents[i]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_partitioned -> " + msg);
+    }
+
+    //--4 release cl resources.
+    for (int p = 0; p < parts; p++)
+    {
+        CLBinding binding(envs[p]);
+        _clPoolFree(part[p].d_nodes);
+        _clPoolFree(part[p].d_edges);
+        _clPoolFree(part[p].d_frontier);
+        _clPoolFree(part[p].d_visited);
+        _clPoolFree(part[p].d_next);
+        _clPoolFree(part[p].d_cost);
+        profileFlush();
+    }
+
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--out-of-core breadth first search (--shard, or an edge array past the
+//--device's largest allocation): the vertices are cut into shards of about
+//--shard_bytes of edges. Frontier, visited and next bitmaps and the levels
+//--stay resident; every level only the shards holding frontier vertices are
+//--streamed into two alternating buffers on the transfer queue, the upload of
+//--one shard overlapping the expansion of the one before.
+//----------------------------------------------------------
+struct EdgeShard
+{
+    int begin, end; // vertices
+    int edge_begin, edge_end;
+};
+
+//--shards of up to shard_edges edges; a vertex with more gets a shard alone
+void splitIntoShards(int no_of_nodes, const Node *h_nodes, long long shard_edges, std::vector<EdgeShard> &shards)
+{
+    shards.clear();
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        int edge_end = h_nodes[v].starting + h_nodes[v].no_of_edges;
+        if (shards.empty() || (edge_end - shards.back().edge_begin > shard_edges && shards.back().end > shards.back().begin))
+            shards.push_back(EdgeShard{v, v, h_nodes[v].starting, h_nodes[v].starting});
+        shards.back().end = v + 1;
+        shards.back().edge_end = edge_end;
+    }
+}
+
+//--whether a bit of [begin, end) is set
+static bool anyBitIn(const cl_uint *bitmap, int begin, int end)
+{
+    for (int v = begin; v < end; v = (v | 31) + 1)
+    {
+        cl_uint bits = bitmap[v >> 5] >> (v & 31);
+        if (end - v < 32 - (v & 31))
+            bits &= (1u << (end - v)) - 1;
+        if (bits)
+            return true;
+    }
+    return false;
+}
+
+//--bytes of edges per shard: --shard, or half the largest allocation. The
+//--transfer and allocation helpers take int sizes, so at most 1 GB.
+size_t outOfCoreShardBytes()
+{
+    size_t bytes = shard_bytes ? shard_bytes : cl_env->max_alloc_size / 2;
+    return std::min<size_t>(bytes, (size_t)1 << 30);
+}
+
+void run_bfs_out_of_core(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int *h_cost, int source)
+{
+    (void)no_of_edges; // the shards are cut from h_nodes
+    int words = (no_of_nodes + 31) / 32;
+    size_t bytes = outOfCoreShardBytes();
+    std::vector<EdgeShard> shards;
+    splitIntoShards(no_of_nodes, h_nodes, std::max<long long>(bytes / sizeof(int), 1), shards);
+
+    int slot_nodes = 1, slot_edges = 1;
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        slot_nodes = std::max(slot_nodes, shards[i].end - shards[i].begin);
+        slot_edges = std::max(slot_edges, shards[i].edge_end - shards[i].edge_begin);
+    }
+    if ((cl_ulong)slot_edges * sizeof(int) > cl_env->max_alloc_size)
+        throw(string("run_bfs_out_of_core()::Error: a vertex's adjacency exceeds the device's largest allocation"));
+    if ((long long)slot_edges * sizeof(int) > INT_MAX || (long long)slot_nodes * sizeof(Node) > INT_MAX)
+        throw(string("run_bfs_out_of_core()::Error: a shard exceeds 2 GB, the limit of the transfer helpers"));
+
+    std::vector<cl_uint> h_frontier(words, 0), h_visited(words, 0);
+    h_frontier[source >> 5] = h_visited[source >> 5] = 1u << (source & 31);
+
+    cl_mem d_frontier, d_visited, d_next, d_cost;
+    cl_mem d_nodes[2], d_edges[2];
+    cl_ulong timers[3] = {0, 0, 0};
+    int level = 0;
+    int h_frontier_size = 1;
+    long long streamed = 0;
+
+    try
+    {
+        //--1 resident state and the two shard buffers
+        cl_event h2dpreevents[4];
+        int h2dcount = 0;
+        d_cost = createDeviceArray(no_of_nodes * sizeof(int), h_cost, h2dpreevents, &h2dcount);
+        d_frontier = createDeviceState(words * sizeof(cl_uint));
+        d_visited = createDeviceState(words * sizeof(cl_uint));
+        d_next = createDeviceState(words * sizeof(cl_uint));
+        h2dpreevents[h2dcount++] = writeDeviceArray(d_frontier, words * sizeof(cl_uint), h_frontier.data());
+        h2dpreevents[h2dcount++] = writeDeviceArray(d_visited, words * sizeof(cl_uint), h_visited.data());
+        waitAndTime(h2dcount, h2dpreevents, PROFILE_H2D, timers);
+        for (int i = 0; i < h2dcount; i++)
+            clReleaseEvent(h2dpreevents[i]);
+        for (int i = 0; i < 2; i++)
+        {
+            d_nodes[i] = _clPoolAlloc(slot_nodes * sizeof(Node));
+            d_edges[i] = _clPoolAlloc(slot_edges * sizeof(int));
+        }
+        std::fill(h_visited.begin(), h_visited.end(), 0); // next starts empty
+        cl_event h2devents[1];
+        h2devents[0] = writeDeviceArray(d_next, words * sizeof(cl_uint), h_visited.data());
+        waitAndTime(1, h2devents, PROFILE_H2D, timers);
+        clReleaseEvent(h2devents[0]);
+
+        //--2 levels
+        cl_event kernelevents[1], d2hevents[1];
+        string kernelstrings[1];
+        for (;;)
+        {
+            int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "out-of-core", "bitmap", profile_mode != PROFILE_OFF);
+            profile_level_record = record;
+
+            if (record >= 0)
+            {
+                level_stats[record].frontier_size = h_frontier_size;
+                level_stats[record].edges = 0;
+                for (int w = 0; w < words; w++)
+                    for (cl_uint b = h_frontier[w]; b; b &= b - 1)
+                        level_stats[record].edges += h_nodes[w * 32 + __builtin_ctz(b)].no_of_edges;
+            }
+
+            //--expand the shards with frontier vertices, shard k in buffer k % 2
+            std::vector<EdgeShard *> active;
+            for (size_t i = 0; i < shards.size(); i++)
+                if (anyBitIn(h_frontier.data(), shards[i].begin, shards[i].end))
+                    active.push_back(&shards[i]);
+
+            cl_event uploads[2][2], expands[2];
+            string expandstrings[2];
+            perfStart("opencl kernels");
+            for (size_t k = 0; k < active.size(); k++)
+            {
+                int slot = k % 2;
+                EdgeShard &shard = *active[k];
+                if (k >= 2)
+                {
+                    //--the buffer is free once the shard before last is expanded
+                    waitAndTime(1, &expands[slot], PROFILE_KERNEL, timers, &expandstrings[slot]);
+                    waitAndTime(2, uploads[slot], PROFILE_H2D, timers);
+                    clReleaseEvent(expands[slot]);
+                    clReleaseEvent(uploads[slot][0]);
+                    clReleaseEvent(uploads[slot][1]);
+                }
+                int count = shard.end - shard.begin;
+                int edge_count = shard.edge_end - shard.edge_begin;
+                uploads[slot][0] = _clMemcpyH2DAsync(d_nodes[slot], 0, count * sizeof(Node), h_nodes + shard.begin);
+                uploads[slot][1] = _clMemcpyH2DAsync(d_edges[slot], 0, std::max(edge_count, 1) * sizeof(int), h_edges + shard.edge_begin);
+                clFlush(cl_env->transfer_queue);
+                streamed++;
+
+                int kernel_id = KERNEL_PART_EXPAND;
+                int kernel_idx = 0;
+                _clSetArgs(kernel_id, kernel_idx++, d_nodes[slot]);
+                _clSetArgs(kernel_id, kernel_idx++, d_edges[slot]);
+                _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+                _clSetArgs(kernel_id, kernel_idx++, d_visited);
+                _clSetArgs(kernel_id, kernel_idx++, d_next);
+                _clSetArgs(kernel_id, kernel_idx++, &shard.begin, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &count, sizeof(int));
+                _clSetArgs(kernel_id, kernel_idx++, &shard.edge_begin, sizeof(int));
+                expands[slot] = _clInvokeKernel(kernel_id, count, work_group_size, 2, uploads[slot]);
+                clFlush(cl_env->queue);
+                expandstrings[slot] = "Shard of vertices " + std::to_string(shard.begin) + ".." + std::to_string(shard.end) +
+                                      " at level " + std::to_string(level);
+            }
+            for (size_t k = active.size() > 2 ? active.size() - 2 : 0; k < active.size(); k++)
+            {
+                int slot = k % 2;
+                waitAndTime(1, &expands[slot], PROFILE_KERNEL, timers, &expandstrings[slot]);
+                waitAndTime(2, uploads[slot], PROFILE_H2D, timers);
+                clReleaseEvent(expands[slot]);
+                clReleaseEvent(uploads[slot][0]);
+                clReleaseEvent(uploads[slot][1]);
+            }
+
+            //--next becomes the frontier: visited |= frontier, levels, the old
+            //--frontier cleared as the next next
+            cl_mem tmp = d_frontier;
+            d_frontier = d_next;
+            d_next = tmp;
+
+            int kernel_id = KERNEL_PART_UPDATE;
+            int kernel_idx = 0;
+            int begin = 0;
+            _clSetArgs(kernel_id, kernel_idx++, d_frontier);
+            _clSetArgs(kernel_id, kernel_idx++, d_visited);
+            _clSetArgs(kernel_id, kernel_idx++, d_next);
+            _clSetArgs(kernel_id, kernel_idx++, d_cost);
+            _clSetArgs(kernel_id, kernel_idx++, &begin, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &no_of_nodes, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &words, sizeof(int));
+            _clSetArgs(kernel_id, kernel_idx++, &level, sizeof(int));
+            kernelevents[0] = _clInvokeKernel(kernel_id, words, work_group_size);
+            perfKernelDone(kernelevents[0]);
+            kernelstrings[0] = "Bitmap update at level " + std::to_string(level);
+            waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            clReleaseEvent(kernelevents[0]);
+
+            //--the new frontier picks the next level's shards
+            d2hevents[0] = readDeviceArray(d_frontier, words * sizeof(cl_uint), h_frontier.data());
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+
+            int discovered = 0;
+            for (int w = 0; w < words; w++)
+                discovered += __builtin_popcount(h_frontier[w]);
+            if (record >= 0)
+                level_stats[record].discovered = discovered;
+            h_frontier_size = discovered;
+            if (h_frontier_size == 0)
+                break;
+            level++;
+        }
+        profile_level_record = -1;
+
+#ifdef VERBOSE
+        printf("Took %d loops, streamed %lld shards of %d (%d edges at most)\n", level + 1, streamed, (int)shards.size(), slot_edges);
+#endif
+
+        //--3 levels back to the host
+        d2hevents[0] = readDeviceArray(d_cost, no_of_nodes * sizeof(int), h_cost);
+        waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+        clReleaseEvent(d2hevents[0]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_out_of_core -> " + msg);
+    }
+
+    //--4 release cl resources.
+    _clPoolFree(d_cost);
+    _clPoolFree(d_frontier);
+    _clPoolFree(d_visited);
+    _clPoolFree(d_next);
+    for (int i = 0; i < 2; i++)
+    {
+        _clPoolFree(d_nodes[i]);
+        _clPoolFree(d_edges[i]);
+    }
+    profileFlush();
+
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--semi-external breadth first search on the host (-e external): only the
+//--frontier, next and visited bitmaps and the levels are kept in memory, the
+//--CSR is read through its mapping (a .csr input is mapped, not loaded).
+//--The frontier is expanded in vertex order, which walks the adjacency array
+//--forward through the file, in batches of about prefetch_bytes of
+//--adjacency; the pages of the next batch are requested with MADV_WILLNEED
+//--while the current one is expanded. With compressed adjacency (compressCsr,
+//--h_edges the byte array) the lists are decoded as they are expanded.
+//----------------------------------------------------------
+
+//--read ahead the pages of [begin, end). Returns the bytes advised.
+static size_t adviseWillNeed(const void *begin, const void *end)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = (size_t)begin / page * page;
+    size_t last = ((size_t)end + page - 1) / page * page;
+    if (last <= first)
+        return 0;
+    madvise((void *)first, last - first, MADV_WILLNEED);
+    return last - first;
+}
+
+//--the frontier vertices from begin on with about bytes of adjacency,
+//--advised in runs split at gaps of more than a page. Returns the end of
+//--the batch.
+static int externalBatch(const cl_uint *frontier, int no_of_nodes, const Node *h_nodes, const int *h_edges, int no_of_edges,
+                         bool compressed, int begin, size_t bytes, long long *advised)
+{
+    const long page = sysconf(_SC_PAGESIZE);
+    const char *adjacency = (const char *)h_edges;
+    const char *run_begin = NULL, *run_end = NULL;
+    size_t batch = 0;
+    int v = begin;
+    while (v < no_of_nodes && batch < bytes)
+    {
+        cl_uint bits = frontier[v >> 5] >> (v & 31);
+        if (!bits)
+        {
+            v = (v | 31) + 1;
+            continue;
+        }
+        v += __builtin_ctz(bits);
+        if (v >= no_of_nodes)
+            break;
+
+        //--compressed lists end where the next one starts
+        const char *first, *last;
+        if (compressed)
+        {
+            first = adjacency + h_nodes[v].starting;
+            last = adjacency + (v + 1 < no_of_nodes ? (size_t)h_nodes[v + 1].starting : (size_t)no_of_edges * sizeof(int));
+        }
+        else
+        {
+            first = adjacency + (size_t)h_nodes[v].starting * sizeof(int);
+            last = first + (size_t)h_nodes[v].no_of_edges * sizeof(int);
+        }
+        if (run_begin && first - run_end > page)
+        {
+            *advised += adviseWillNeed(run_begin, run_end);
+            run_begin = NULL;
+        }
+        if (!run_begin)
+            run_begin = first;
+        run_end = last;
+        batch += last - first;
+        v++;
+    }
+    if (run_begin)
+        *advised += adviseWillNeed(run_begin, run_end);
+    return std::min(v, no_of_nodes);
+}
+
+void run_bfs_semi_external(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int *h_cost, int source,
+                           bool compressed = false)
+{
+    int words = (no_of_nodes + 31) / 32;
+    std::vector<cl_uint> frontier(words, 0), next(words, 0), visited(words, 0);
+    frontier[source >> 5] = visited[source >> 5] = 1u << (source & 31);
+    h_cost[source] = 0;
+
+    cl_ulong timers[3] = {0, 0, 0}; // nothing on the device
+    int level = 0;
+    int h_frontier_size = 1;
+    long long advised = 0;
+    struct rusage usage_start, usage_end;
+    getrusage(RUSAGE_SELF, &usage_start);
+
+    perfStart("host traversal");
+    for (;;)
+    {
+        int record = level_trace_file.empty() ? -1 : beginLevelStats(level, "semi-external", "bitmap", false);
+        long long frontier_edges = 0;
+
+        //--expand batch [begin, end) while [end, ahead) is read ahead
+        int begin = 0;
+        int end = externalBatch(frontier.data(), no_of_nodes, h_nodes, h_edges, no_of_edges, compressed, 0, prefetch_bytes, &advised);
+        while (begin < end)
+        {
+            int ahead = externalBatch(frontier.data(), no_of_nodes, h_nodes, h_edges, no_of_edges, compressed, end, prefetch_bytes,
+                                      &advised);
+            for (int v = begin; v < end;)
+            {
+                cl_uint bits = frontier[v >> 5] >> (v & 31);
+                if (!bits)
+                {
+                    v = (v | 31) + 1;
+                    continue;
+                }
+                v += __builtin_ctz(bits);
+                if (v >= end)
+                    break;
+
+                if (compressed)
+                {
+                    const unsigned char *p = (const unsigned char *)h_edges + h_nodes[v].starting;
+                    int id = v;
+                    for (int i = 0; i < h_nodes[v].no_of_edges; i++)
+                    {
+                        unsigned x;
+                        p = varintGet(p, &x);
+                        id = varintNeighbour(v, i, id, x);
+                        if (!(visited[id >> 5] >> (id & 31) & 1))
+                            next[id >> 5] |= 1u << (id & 31);
+                    }
+                }
+                else
+                {
+                    for (int i = h_nodes[v].starting; i < h_nodes[v].starting + h_nodes[v].no_of_edges; i++)
+                    {
+                        int id = h_edges[i];
+                        if (!(visited[id >> 5] >> (id & 31) & 1))
+                            next[id >> 5] |= 1u << (id & 31);
+                    }
+                }
+                frontier_edges += h_nodes[v].no_of_edges;
+                v++;
+            }
+            begin = end;
+            end = ahead;
+        }
+
+        //--next becomes the frontier
+        int discovered = 0;
+        for (int w = 0; w < words; w++)
+        {
+            cl_uint bits = next[w];
+            visited[w] |= bits;
+            discovered += __builtin_popcount(bits);
+            for (; bits; bits &= bits - 1)
+                h_cost[w * 32 + __builtin_ctz(bits)] = level + 1;
+        }
+        frontier.swap(next);
+        std::fill(next.begin(), next.end(), 0);
+
+        if (record >= 0)
+        {
+            LevelStats &stats = level_stats[record];
+            stats.frontier_size = h_frontier_size;
+            stats.edges = frontier_edges;
+            stats.discovered = discovered;
+        }
+        h_frontier_size = discovered;
+        if (h_frontier_size == 0)
+            break;
+        level++;
+    }
+    perfStop("host traversal");
+    getrusage(RUSAGE_SELF, &usage_end);
+
+#ifdef VERBOSE
+    printf("Took %d loops, %lld MB advised, %ld major page faults\n", level + 1, advised >> 20,
+           usage_end.ru_majflt - usage_start.ru_majflt);
+#endif
+
+    if (!level_trace_file.empty())
+        writeLevelTrace(level_trace_file);
+
+    printProfile(timers);
+}
+
+//----------------------------------------------------------
+//--graph kept on the device across runs, plus the buffers of the
+//--multi-source engine sized for capacity queries (query server)
+//----------------------------------------------------------
+#define MSBFS_MAX_BATCH 32 // one bit per query in a uint
+
+struct ResidentGraph
+{
+    int no_of_nodes;
+    int no_of_edges;
+    int capacity; // queries per batch, <= MSBFS_MAX_BATCH
+    cl_mem d_nodes, d_edges;
+    cl_mem d_sources, d_frontier, d_next, d_seen, d_cost, d_active;
+};
+
+void createResidentGraph(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, ResidentGraph *graph)
+{
+    graph->no_of_nodes = no_of_nodes;
+    graph->no_of_edges = no_of_edges;
+    //--the level arrays of a batch share one buffer, whose size is an int
+    graph->capacity = std::max(1, std::min(MSBFS_MAX_BATCH, (int)(INT_MAX / sizeof(int) / std::max(no_of_nodes, 1))));
+
+    try
+    {
+        cl_event events[2];
+        int count = 0;
+        graph->d_nodes = createDeviceArray(no_of_nodes * sizeof(Node), h_nodes, events, &count);
+        graph->d_edges = createDeviceArray(no_of_edges * sizeof(int), h_edges, events, &count);
+        graph->d_sources = createDeviceState(MSBFS_MAX_BATCH * sizeof(int));
+        graph->d_frontier = _clPoolAlloc(no_of_nodes * sizeof(cl_uint));
+        graph->d_next = _clPoolAlloc(no_of_nodes * sizeof(cl_uint));
+        graph->d_seen = _clPoolAlloc(no_of_nodes * sizeof(cl_uint));
+        graph->d_cost = _clPoolAlloc(graph->capacity * no_of_nodes * sizeof(int));
+        graph->d_active = createDeviceState(sizeof(int));
+
+        _clWait(count, events);
+        for (int i = 0; i < count; i++)
+            clReleaseEvent(events[i]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in createResidentGraph -> " + msg);
+    }
+}
+
+void releaseResidentGraph(ResidentGraph *graph)
+{
+    _clPoolFree(graph->d_nodes);
+    _clPoolFree(graph->d_edges);
+    _clPoolFree(graph->d_sources);
+    _clPoolFree(graph->d_frontier);
+    _clPoolFree(graph->d_next);
+    _clPoolFree(graph->d_seen);
+    _clPoolFree(graph->d_cost);
+    _clPoolFree(graph->d_active);
+}
+
+//----------------------------------------------------------
+//--batch of breadth first searches on a resident graph, one traversal for
+//--all of them. Stops after max_depth levels (-1: no limit). h_cost holds
+//--batch level arrays of no_of_nodes each. Returns the number of levels run.
+//----------------------------------------------------------
+int run_bfs_opencl_batch(ResidentGraph *graph, int batch, const int *sources, int max_depth, int *h_cost)
+{
+    int no_of_nodes = graph->no_of_nodes;
+    int level = 0;
+
+    cl_ulong timers[3] = {0, 0, 0};
+
+    try
+    {
+        if (batch < 1 || batch > graph->capacity)
+            throw(string("batch of ") + std::to_string(batch) + " queries, capacity is " + std::to_string(graph->capacity));
+
+        cl_event h2devents[1];
+        h2devents[0] = writeDeviceArray(graph->d_sources, batch * sizeof(int), sources);
+        waitAndTime(1, h2devents, PROFILE_H2D, timers);
+        clReleaseEvent(h2devents[0]);
+
+        int kernel_idx = 0;
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, graph->d_sources);
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, graph->d_frontier);
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, graph->d_next);
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, graph->d_seen);
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, graph->d_cost);
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, &batch, sizeof(int));
+        _clSetArgs(KERNEL_MSBFS_INIT, kernel_idx++, &no_of_nodes, sizeof(int));
+
+        kernel_idx = 0;
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, graph->d_nodes);
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, graph->d_edges);
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, graph->d_frontier);
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, graph->d_next);
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, graph->d_seen);
+        _clSetArgs(KERNEL_MSBFS_EXPAND, kernel_idx++, &no_of_nodes, sizeof(int));
+
+        kernel_idx = 0;
+        _clSetArgs(KERNEL_MSBFS_UPDATE, kernel_idx++, graph->d_frontier);
+        _clSetArgs(KERNEL_MSBFS_UPDATE, kernel_idx++, graph->d_next);
+        _clSetArgs(KERNEL_MSBFS_UPDATE, kernel_idx++, graph->d_seen);
+        _clSetArgs(KERNEL_MSBFS_UPDATE, kernel_idx++, graph->d_cost);
+        _clSetArgs(KERNEL_MSBFS_UPDATE, kernel_idx++, graph->d_active);
+
+        cl_event kernelevents[2];
+        string kernelstrings[2];
+        cl_event d2hevents[1];
+        kernelevents[0] = _clInvokeKernel(KERNEL_MSBFS_INIT, no_of_nodes, work_group_size);
+        kernelstrings[0] = "Batch init of " + std::to_string(batch) + " queries";
+        waitAndTime(1, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+        clReleaseEvent(kernelevents[0]);
+
+        int h_active = 1;
+        while (h_active && (max_depth < 0 || level < max_depth))
+        {
+            h_active = 0;
+            h2devents[0] = writeDeviceArray(graph->d_active, sizeof(int), &h_active);
+            waitAndTime(1, h2devents, PROFILE_H2D, timers);
+            clReleaseEvent(h2devents[0]);
+
+            _clSetArgs(KERNEL_MSBFS_UPDATE, 5, &level, sizeof(int));
+            _clSetArgs(KERNEL_MSBFS_UPDATE, 6, &no_of_nodes, sizeof(int));
+
+            kernelstrings[0] = "Batch expand at level " + std::to_string(level);
+            kernelstrings[1] = "Batch update at level " + std::to_string(level);
+            perfStart("opencl kernels");
+            kernelevents[0] = _clInvokeKernel(KERNEL_MSBFS_EXPAND, no_of_nodes, work_group_size);
+            kernelevents[1] = _clInvokeKernel(KERNEL_MSBFS_UPDATE, no_of_nodes, work_group_size);
+            perfKernelDone(kernelevents[1]);
+            waitAndTime(2, kernelevents, PROFILE_KERNEL, timers, kernelstrings);
+            clReleaseEvent(kernelevents[0]);
+            clReleaseEvent(kernelevents[1]);
+
+            d2hevents[0] = readDeviceArray(graph->d_active, sizeof(int), &h_active);
+            waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+            clReleaseEvent(d2hevents[0]);
+            level++;
+        }
+
+        d2hevents[0] = readDeviceArray(graph->d_cost, batch * no_of_nodes * sizeof(int), h_cost);
+        waitAndTime(1, d2hevents, PROFILE_D2H, timers);
+        clReleaseEvent(d2hevents[0]);
+    }
+    catch (std::string msg)
+    {
+        profileDiscard();
+        throw("in run_bfs_opencl_batch -> " + msg);
+    }
+
+    profileFlush();
+    printProfile(timers);
+    return level;
+}
+
+//----------------------------------------------------------
+//--independent queries side by side on the environments of a split device
+//--(_clSplit): one thread per environment, each taking the next query once
+//--it has finished one. Query q starts at sources[q] and fills h_cost[q];
+//--times[q], if given, gets its end-to-end and device times.
+//----------------------------------------------------------
+struct QueryTimes
+{
+    unsigned long long e2e_ns;
+    cl_ulong timers[3]; // last_run_timers of the query
+};
+
+void run_bfs_concurrent(std::vector<CLEnvironment> &envs, Engine engine, int queries, const int *sources,
+                        int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, int **h_cost, QueryTimes *times)
+{
+    std::atomic<int> next(0);
+    std::mutex error_mutex;
+    std::string error;
+
+    //--the engines read these per thread
+    size_t group_size = work_group_size;
+    ProfileMode mode = profile_mode;
+    bool quiet = profile_quiet;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < envs.size(); t++)
+    {
+        threads.push_back(std::thread([&, t]() {
+            CLBinding binding(envs[t]);
+            work_group_size = group_size;
+            profile_mode = mode;
+            profile_quiet = quiet;
+            char *h_mask = malloc_aligned<char>(no_of_nodes);
+            char *h_new_mask = malloc_aligned<char>(no_of_nodes);
+            char *h_visited = malloc_aligned<char>(no_of_nodes);
+            try
+            {
+                for (int q = next++; q < queries; q = next++)
+                {
+                    int source = sources[q];
+                    int *cost = h_cost[q];
+                    memset(h_mask, 0, no_of_nodes);
+                    memset(h_new_mask, 0, no_of_nodes);
+                    memset(h_visited, 0, no_of_nodes);
+                    h_mask[source] = true;
+                    h_visited[source] = true;
+                    cost[source] = 0;
+
+                    unsigned long long start = traceNow();
+                    if (engine == ENGINE_QUEUE)
+                        run_bfs_opencl_queue(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+                    else if (engine == ENGINE_ADAPTIVE)
+                        run_bfs_opencl_adaptive(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+                    else if (engine == ENGINE_HYBRID)
+                        run_bfs_hybrid(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+                    else if (engine == ENGINE_MASK)
+                        run_bfs_opencl(no_of_nodes, h_nodes, no_of_edges, h_edges, h_mask, h_new_mask, h_visited, cost);
+                    else
+                        throw(string("run_bfs_concurrent()::Error: the engine does not run per sub-device"));
+                    if (times)
+                    {
+                        times[q].e2e_ns = traceNow() - start;
+                        for (int i = 0; i < 3; i++)
+                            times[q].timers[i] = last_run_timers[i];
+                    }
+                }
+            }
+            catch (std::string msg)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (error.empty())
+                    error = msg;
+                next = queries; // the other threads stop after their query
+            }
+            free(h_mask);
+            free(h_new_mask);
+            free(h_visited);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    if (!error.empty())
+        throw("in run_bfs_concurrent -> " + error);
+}
+
+#endif //_ENGINES_
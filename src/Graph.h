@@ -0,0 +1,583 @@
+//------------------------------------------
+//--graph input: Matrix Market reader, CSR construction, synthetic
+//--generators and a binary CSR file that can be mapped without parsing
+//------------------------------------------
+#ifndef _GRAPH_
+#define _GRAPH_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.h"
+#include "Arena.h"
+#include "matrixmarket/mmio.h"
+
+struct Node
+{
+    int starting;
+    int no_of_edges;
+};
+
+// Edge list as read from a file or generator, 0-based
+struct EdgeList
+{
+    int no_of_nodes;
+    bool undirected; // every edge also goes the other way
+    std::vector<int> from, to;
+};
+
+//----------------------------------------------------------
+//--read a Matrix Market coordinate file. Symmetric files are undirected.
+//----------------------------------------------------------
+void readMatrixMarket(const char *path, EdgeList *list)
+{
+    MM_typecode matcode;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        throw(std::string("Error Reading graph file ") + path);
+
+    if (mm_read_banner(fp, &matcode) != 0)
+    {
+        fclose(fp);
+        throw(std::string("Could not process Matrix Market banner."));
+    }
+
+    // Only supports a subset of the Matrix Market data types.
+    if (mm_is_complex(matcode) && mm_is_matrix(matcode) &&
+            mm_is_sparse(matcode) )
+    {
+        fclose(fp);
+        throw(std::string("Sorry, this application does not support Market Market type: [") + mm_typecode_to_str(matcode) + "]");
+    }
+
+    list->undirected = mm_is_symmetric(matcode);
+
+    // find out size of sparse matrix ....
+    int N, nz;
+    if (mm_read_mtx_crd_size(fp, &list->no_of_nodes, &N, &nz) != 0)
+    {
+        fclose(fp);
+        throw(std::string("Could not read Matrix Market size line."));
+    }
+
+    if(list->no_of_nodes != N) {
+        printf("[WARNING] Not sure if non-square matrices work properly...");
+    }
+
+    list->from.resize(nz);
+    list->to.resize(nz);
+    bool pattern = mm_is_pattern(matcode);
+    for (int i = 0; i < nz; i++)
+    {
+        int x, y;
+        double val;
+        int fields = pattern ? fscanf(fp, "%d %d\n", &x, &y) : fscanf(fp, "%d %d %lg\n", &x, &y, &val);
+        if (fields != (pattern ? 2 : 3)) {
+            printf("Failed to read line %d\n", i);
+        }
+        list->from[i] = x - 1;  /* adjust from 1-based to 0-based */
+        list->to[i] = y - 1;
+    }
+
+    if (fp != stdin) fclose(fp);
+}
+
+//----------------------------------------------------------
+//--synthetic graphs:
+//--  kron <scale> <edgefactor>: Graph500 Kronecker (R-MAT 0.57/0.19/0.19)
+//--  grid <width> <height>:     4-neighbour lattice, road-network like
+//--  random <nodes> <edges>:    uniform random (Erdos-Renyi G(n, m))
+//--all undirected
+//----------------------------------------------------------
+void generateGraph(const std::string &type, long long a, long long b, unsigned long long seed, EdgeList *list)
+{
+    std::mt19937_64 rng(seed);
+    list->undirected = true;
+    list->from.clear();
+    list->to.clear();
+
+    if (type == "kron")
+    {
+        const double A = 0.57, B = 0.19, C = 0.19;
+        int scale = a;
+        list->no_of_nodes = 1 << scale;
+        long long edges = b * list->no_of_nodes;
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+        //--scramble vertex ids so high degree vertices are not clustered at 0
+        std::vector<int> perm(list->no_of_nodes);
+        for (int i = 0; i < list->no_of_nodes; i++)
+            perm[i] = i;
+        std::shuffle(perm.begin(), perm.end(), rng);
+
+        list->from.reserve(edges);
+        list->to.reserve(edges);
+        for (long long e = 0; e < edges; e++)
+        {
+            int u = 0, v = 0;
+            for (int bit = 0; bit < scale; bit++)
+            {
+                double r = uniform(rng);
+                if (r >= A + B + C)
+                {
+                    u |= 1 << bit;
+                    v |= 1 << bit;
+                }
+                else if (r >= A + B)
+                    u |= 1 << bit;
+                else if (r >= A)
+                    v |= 1 << bit;
+            }
+            list->from.push_back(perm[u]);
+            list->to.push_back(perm[v]);
+        }
+    }
+    else if (type == "grid")
+    {
+        int width = a, height = b;
+        list->no_of_nodes = width * height;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                int id = y * width + x;
+                if (x + 1 < width)
+                {
+                    list->from.push_back(id);
+                    list->to.push_back(id + 1);
+                }
+                if (y + 1 < height)
+                {
+                    list->from.push_back(id);
+                    list->to.push_back(id + width);
+                }
+            }
+        }
+    }
+    else if (type == "random")
+    {
+        list->no_of_nodes = a;
+        std::uniform_int_distribution<int> vertex(0, a - 1);
+        list->from.reserve(b);
+        list->to.reserve(b);
+        for (long long e = 0; e < b; e++)
+        {
+            list->from.push_back(vertex(rng));
+            list->to.push_back(vertex(rng));
+        }
+    }
+    else
+        throw(std::string("Unknown graph type ") + type);
+}
+
+//----------------------------------------------------------
+//--compressed adjacency lists from an edge list, duplicate edges dropped and
+//--every list sorted. Counting sort by source into the edge array, then each
+//--list is sorted and compacted in place. h_nodes and h_edges are page
+//--aligned and come from arena, or from malloc if arena is NULL (release
+//--with free()); h_edges may be longer than the duplicate-free no_of_edges.
+//----------------------------------------------------------
+void buildCsr(const EdgeList &list, Node **h_nodes, int *no_of_edges, int **h_edges, Arena *arena = NULL)
+{
+    int no_of_nodes = list.no_of_nodes;
+    Node *nodes = hostAlloc<Node>(arena, no_of_nodes);
+
+    //--degrees, duplicates included
+    for (int i = 0; i < no_of_nodes; i++)
+        nodes[i].no_of_edges = 0;
+    for (size_t i = 0; i < list.from.size(); i++)
+    {
+        nodes[list.from[i]].no_of_edges++;
+        if (list.undirected)
+            nodes[list.to[i]].no_of_edges++;
+    }
+
+    long long total = 0;
+    for (int i = 0; i < no_of_nodes; i++)
+    {
+        nodes[i].starting = total;
+        total += nodes[i].no_of_edges;
+        nodes[i].no_of_edges = 0; // fill cursor
+    }
+    if (total > INT_MAX)
+        throw(std::string("buildCsr()::Error: more than INT_MAX edges"));
+
+    int *edges = hostAlloc<int>(arena, total);
+    for (size_t i = 0; i < list.from.size(); i++)
+    {
+        int from = list.from[i], to = list.to[i];
+        edges[nodes[from].starting + nodes[from].no_of_edges++] = to;
+        if (list.undirected)
+            edges[nodes[to].starting + nodes[to].no_of_edges++] = from;
+    }
+
+    //--sort and deduplicate every list, moving it down over the dropped edges
+    int index = 0;
+    for (int i = 0; i < no_of_nodes; i++)
+    {
+        int *first = edges + nodes[i].starting;
+        int *last = first + nodes[i].no_of_edges;
+        std::sort(first, last);
+        last = std::unique(first, last);
+        int count = last - first;
+        if (first != edges + index)
+            memmove(edges + index, first, count * sizeof(int));
+        nodes[i].starting = index;
+        nodes[i].no_of_edges = count;
+        index += count;
+    }
+
+    *h_nodes = nodes;
+    *h_edges = edges;
+    *no_of_edges = index;
+}
+
+//----------------------------------------------------------
+//--locality reordering (--reorder): vertex ids that put vertices visited
+//--together next to each other, so the per-vertex arrays are read from
+//--fewer cache lines and device accesses coalesce
+//--  degree: by decreasing degree, the hubs share the first cache lines
+//--  rcm:    reverse Cuthill-McKee, narrow bandwidth for meshes and roads
+//--  bfs:    breadth first order from the largest-degree vertex of every
+//--          component, neighbours in id order
+//--new_id[v] is the new id of input vertex v.
+//----------------------------------------------------------
+enum ReorderMode
+{
+    REORDER_NONE,
+    REORDER_DEGREE,
+    REORDER_RCM,
+    REORDER_BFS
+};
+
+void reorderVertices(int no_of_nodes, const Node *h_nodes, const int *h_edges, ReorderMode mode, std::vector<int> &new_id)
+{
+    //--order[i] is the input vertex that gets id i
+    std::vector<int> order(no_of_nodes);
+    for (int v = 0; v < no_of_nodes; v++)
+        order[v] = v;
+    auto fewer_edges = [h_nodes](int a, int b) { return h_nodes[a].no_of_edges < h_nodes[b].no_of_edges; };
+    auto more_edges = [h_nodes](int a, int b) { return h_nodes[a].no_of_edges > h_nodes[b].no_of_edges; };
+
+    if (mode == REORDER_DEGREE)
+        std::stable_sort(order.begin(), order.end(), more_edges);
+    else if (mode == REORDER_RCM || mode == REORDER_BFS)
+    {
+        //--every component from its start vertex: the smallest degree for
+        //--rcm, which also takes neighbours by increasing degree, the
+        //--largest for bfs
+        std::vector<int> starts(order);
+        if (mode == REORDER_RCM)
+            std::stable_sort(starts.begin(), starts.end(), fewer_edges);
+        else
+            std::stable_sort(starts.begin(), starts.end(), more_edges);
+        std::vector<char> placed(no_of_nodes, false);
+        int tail = 0;
+        for (int i = 0; i < no_of_nodes; i++)
+        {
+            if (placed[starts[i]])
+                continue;
+            int head = tail;
+            order[tail++] = starts[i];
+            placed[starts[i]] = true;
+            for (; head < tail; head++)
+            {
+                int u = order[head];
+                int first = tail;
+                for (int e = h_nodes[u].starting; e < h_nodes[u].starting + h_nodes[u].no_of_edges; e++)
+                    if (!placed[h_edges[e]])
+                    {
+                        placed[h_edges[e]] = true;
+                        order[tail++] = h_edges[e];
+                    }
+                if (mode == REORDER_RCM)
+                    std::stable_sort(order.begin() + first, order.begin() + tail, fewer_edges);
+            }
+        }
+        if (mode == REORDER_RCM)
+            std::reverse(order.begin(), order.end());
+    }
+
+    new_id.resize(no_of_nodes);
+    for (int i = 0; i < no_of_nodes; i++)
+        new_id[order[i]] = i;
+}
+
+//--the graph with every vertex v renamed new_id[v], lists sorted again.
+//--Arrays as in buildCsr.
+void permuteCsr(int no_of_nodes, const Node *h_nodes, int no_of_edges, const int *h_edges, const std::vector<int> &new_id,
+                Node **p_nodes, int **p_edges, Arena *arena = NULL)
+{
+    std::vector<int> old_id(no_of_nodes);
+    for (int v = 0; v < no_of_nodes; v++)
+        old_id[new_id[v]] = v;
+
+    Node *nodes = hostAlloc<Node>(arena, no_of_nodes);
+    int *edges = hostAlloc<int>(arena, std::max(no_of_edges, 1));
+    int index = 0;
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        const Node &node = h_nodes[old_id[v]];
+        nodes[v].starting = index;
+        nodes[v].no_of_edges = node.no_of_edges;
+        for (int e = node.starting; e < node.starting + node.no_of_edges; e++)
+            edges[index++] = new_id[h_edges[e]];
+        std::sort(edges + nodes[v].starting, edges + index);
+    }
+
+    *p_nodes = nodes;
+    *p_edges = edges;
+}
+
+//--per-vertex values of a reordered graph back into input order; with
+//--old_id (the inverse of new_id) the values are vertex ids and renamed too
+void unpermute(int no_of_nodes, const int *new_id, int *values, const int *old_id = NULL)
+{
+    std::vector<int> copy(values, values + no_of_nodes);
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        int value = copy[new_id[v]];
+        values[v] = old_id && value >= 0 ? old_id[value] : value;
+    }
+}
+
+//--parts vertex ranges with about the same number of edges each; range i
+//--is [bounds[i], bounds[i + 1])
+void splitByEdges(int no_of_nodes, const Node *h_nodes, int no_of_edges, int parts, std::vector<int> &bounds)
+{
+    bounds.assign(1, 0);
+    int v = 0;
+    for (int part = 1; part < parts; part++)
+    {
+        long long target = (long long)no_of_edges * part / parts;
+        while (v < no_of_nodes && h_nodes[v].starting < target)
+            v++;
+        bounds.push_back(std::max(v, bounds.back()));
+    }
+    bounds.push_back(no_of_nodes);
+}
+
+//----------------------------------------------------------
+//--compressed adjacency (--compress): Node.starting is the byte offset of
+//--the vertex's list, Node.no_of_edges still its length. A list holds the
+//--zigzag delta of its first neighbour from the vertex, then the gaps
+//--between consecutive (sorted) neighbours, each as a little-endian
+//--base-128 varint. The byte array is padded to whole ints so engines can
+//--take it in place of the edge array.
+//----------------------------------------------------------
+static inline unsigned char *varintPut(unsigned char *p, unsigned x)
+{
+    while (x >= 128)
+    {
+        *p++ = (x & 127) | 128;
+        x >>= 7;
+    }
+    *p++ = x;
+    return p;
+}
+
+static inline const unsigned char *varintGet(const unsigned char *p, unsigned *x)
+{
+    unsigned value = 0;
+    int shift = 0;
+    unsigned char b;
+    do
+    {
+        b = *p++;
+        value |= (unsigned)(b & 127) << shift;
+        shift += 7;
+    } while (b & 128);
+    *x = value;
+    return p;
+}
+
+//--neighbour i of vertex v from the varint x and neighbour i - 1 (prev)
+static inline int varintNeighbour(int v, int i, int prev, unsigned x)
+{
+    return i ? prev + (int)x : v + (int)((x >> 1) ^ -(x & 1));
+}
+
+//--no_of_words: length of c_bytes in ints. Arrays as in buildCsr.
+void compressCsr(int no_of_nodes, const Node *h_nodes, const int *h_edges, Node **c_nodes, int *no_of_words,
+                 unsigned char **c_bytes, Arena *arena = NULL)
+{
+    unsigned char scratch[5];
+    Node *nodes = hostAlloc<Node>(arena, no_of_nodes);
+    long long total = 0;
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        nodes[v].starting = total;
+        nodes[v].no_of_edges = h_nodes[v].no_of_edges;
+        const int *list = h_edges + h_nodes[v].starting;
+        for (int i = 0; i < h_nodes[v].no_of_edges; i++)
+        {
+            int delta = i ? list[i] - list[i - 1] : list[i] - v;
+            unsigned x = i ? (unsigned)delta : ((unsigned)delta << 1) ^ (unsigned)(delta >> 31);
+            total += varintPut(scratch, x) - scratch;
+        }
+        if (total > INT_MAX)
+            throw(std::string("compressCsr()::Error: more than INT_MAX bytes"));
+    }
+
+    int words = (total + sizeof(int) - 1) / sizeof(int);
+    unsigned char *bytes = (unsigned char *)hostAlloc<int>(arena, std::max(words, 1));
+    unsigned char *p = bytes;
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        const int *list = h_edges + h_nodes[v].starting;
+        for (int i = 0; i < h_nodes[v].no_of_edges; i++)
+        {
+            int delta = i ? list[i] - list[i - 1] : list[i] - v;
+            p = varintPut(p, i ? (unsigned)delta : ((unsigned)delta << 1) ^ (unsigned)(delta >> 31));
+        }
+    }
+    memset(p, 0, bytes + (size_t)words * sizeof(int) - p);
+
+    *c_nodes = nodes;
+    *c_bytes = bytes;
+    *no_of_words = words;
+}
+
+//----------------------------------------------------------
+//--binary CSR file: a header page, then the Node array and the edge array,
+//--each starting on a page boundary so a mapping can be handed to the
+//--device in zero-copy mode
+//----------------------------------------------------------
+#define CSR_MAGIC "BFSCSR1"
+#define CSR_PAGE 4096
+
+struct CsrHeader
+{
+    char magic[8];
+    long long no_of_nodes;
+    long long no_of_edges;
+    long long nodes_offset;
+    long long edges_offset;
+    long long original_offset; // input id of every stored vertex, 0 if not reordered
+};
+
+static long long csrAlign(long long offset)
+{
+    return (offset + CSR_PAGE - 1) / CSR_PAGE * CSR_PAGE;
+}
+
+//--h_original: input id of every vertex of a reordered graph, or NULL
+void writeCsr(const char *path, int no_of_nodes, const Node *h_nodes, int no_of_edges, const int *h_edges,
+              const int *h_original = NULL)
+{
+    CsrHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, CSR_MAGIC);
+    header.no_of_nodes = no_of_nodes;
+    header.no_of_edges = no_of_edges;
+    header.nodes_offset = CSR_PAGE;
+    header.edges_offset = csrAlign(header.nodes_offset + (long long)no_of_nodes * sizeof(Node));
+    if (h_original)
+        header.original_offset = csrAlign(header.edges_offset + (long long)no_of_edges * sizeof(int));
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        throw(std::string("writeCsr()::Error: Unable to open ") + path);
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fseek(fp, header.nodes_offset, SEEK_SET) == 0;
+    ok = ok && fwrite(h_nodes, sizeof(Node), no_of_nodes, fp) == (size_t)no_of_nodes;
+    ok = ok && fseek(fp, header.edges_offset, SEEK_SET) == 0;
+    ok = ok && fwrite(h_edges, sizeof(int), no_of_edges, fp) == (size_t)no_of_edges;
+    if (h_original)
+    {
+        ok = ok && fseek(fp, header.original_offset, SEEK_SET) == 0;
+        ok = ok && fwrite(h_original, sizeof(int), no_of_nodes, fp) == (size_t)no_of_nodes;
+    }
+    fclose(fp);
+    if (!ok)
+        throw(std::string("writeCsr()::Error: Unable to write ") + path);
+}
+
+//--a region of count items of size bytes at offset lies inside the file
+static bool csrFits(long long offset, long long count, long long size, long long file_size)
+{
+    return offset >= 0 && offset <= file_size && count <= (file_size - offset) / size;
+}
+
+//--map a file written by writeCsr. The mapping is private: writes through it
+//--never reach the file. Release with munmap(*mapping, *mapping_size).
+//--*h_original is set to the stored input ids, NULL if not reordered.
+void mapCsr(const char *path, int *no_of_nodes, Node **h_nodes, int *no_of_edges, int **h_edges,
+            void **mapping, size_t *mapping_size, int **h_original = NULL)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        throw(std::string("mapCsr()::Error: Unable to open ") + path);
+
+    struct stat st;
+    CsrHeader header;
+    if (fstat(fd, &st) != 0 || read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, CSR_MAGIC, sizeof(header.magic)) != 0 ||
+        header.no_of_nodes < 0 || header.no_of_nodes > INT_MAX ||
+        header.no_of_edges < 0 || header.no_of_edges > INT_MAX ||
+        !csrFits(header.nodes_offset, header.no_of_nodes, sizeof(Node), st.st_size) ||
+        !csrFits(header.edges_offset, header.no_of_edges, sizeof(int), st.st_size) ||
+        (header.original_offset && !csrFits(header.original_offset, header.no_of_nodes, sizeof(int), st.st_size)))
+    {
+        close(fd);
+        throw(std::string("mapCsr()::Error: Not a CSR file ") + path);
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        throw(std::string("mapCsr()::Error: Unable to map ") + path);
+
+    //--engines index the edge array by every Node and callers index by the
+    //--stored input ids: the lists must lie in the edge array and the ids be
+    //--a permutation. Checked before any output is set, so nothing points
+    //--into a failed map.
+    Node *nodes = (Node *)((char *)base + header.nodes_offset);
+    for (long long v = 0; v < header.no_of_nodes; v++)
+    {
+        if (nodes[v].starting < 0 || nodes[v].no_of_edges < 0 ||
+            (long long)nodes[v].starting + nodes[v].no_of_edges > header.no_of_edges)
+        {
+            munmap(base, st.st_size);
+            throw(std::string("mapCsr()::Error: Corrupt adjacency list in ") + path);
+        }
+    }
+    int *original = header.original_offset ? (int *)((char *)base + header.original_offset) : NULL;
+    if (h_original && original)
+    {
+        std::vector<char> seen(header.no_of_nodes, false);
+        for (long long v = 0; v < header.no_of_nodes; v++)
+        {
+            int id = original[v];
+            if (id < 0 || id >= header.no_of_nodes || seen[id])
+            {
+                munmap(base, st.st_size);
+                throw(std::string("mapCsr()::Error: Corrupt vertex permutation in ") + path);
+            }
+            seen[id] = true;
+        }
+    }
+
+    *no_of_nodes = header.no_of_nodes;
+    *no_of_edges = header.no_of_edges;
+    *h_nodes = nodes;
+    *h_edges = (int *)((char *)base + header.edges_offset);
+    if (h_original)
+        *h_original = original;
+    *mapping = base;
+    *mapping_size = st.st_size;
+}
+
+#endif //_GRAPH_
@@ -5,6 +5,8 @@ typedef struct{
     int no_of_edges;
 } Node;
 
+//--g_stats is NULL unless per-level statistics are collected, then
+//--g_stats[0] counts frontier vertices and g_stats[1] the edges inspected.
 __kernel void BFS_1(const __global Node* g_nodes,
                     const __global int* g_edges,
                     __global char* g_mask, 
@@ -12,10 +14,28 @@ __kernel void BFS_1(const __global Node* g_nodes,
                     __global char* g_visited, 
                     __global int* g_cost, 
                     __global char* done,
-                    const int no_of_nodes){
+                    const int no_of_nodes,
+                    __global int* g_stats){
+    __local int l_stats[2];
+
     int tid = get_global_id(0);
+    if(g_stats)
+    {
+        if(get_local_id(0) == 0)
+        {
+            l_stats[0] = 0;
+            l_stats[1] = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
     if(tid < no_of_nodes && g_mask[tid]) 
     {
+        if(g_stats)
+        {
+            atomic_inc(&l_stats[0]);
+            atomic_add(&l_stats[1], g_nodes[tid].no_of_edges);
+        }
         g_mask[tid]=false;
         for(int i = g_nodes[tid].starting; i < g_nodes[tid].starting + g_nodes[tid].no_of_edges; i++) 
         {
@@ -28,5 +48,443 @@ __kernel void BFS_1(const __global Node* g_nodes,
                 *done = false;
             }
         }
-    }	
-}
\ No newline at end of file
+    }
+
+    if(g_stats)
+    {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if(get_local_id(0) == 0 && l_stats[0])
+        {
+            atomic_add(&g_stats[0], l_stats[0]);
+            atomic_add(&g_stats[1], l_stats[1]);
+        }
+    }
+}
+
+//--------------------------------------------------
+//--Top-down step over a compact frontier queue.
+//--Discoveries are first collected in a per-group __local queue; the group
+//--then reserves room in the global queue with a single atomic and flushes
+//--its entries coalesced. Discoveries that do not fit spill to the global
+//--queue directly. g_cost doubles as the visited array (-1 = unvisited).
+//--g_counters[0] is the next queue's length, g_counters[1] accumulates the
+//--number of edges leaving the next frontier and g_counters[2] the end of
+//--the highest adjacency list it needs (for chunked edge uploads).
+__kernel void BFS_QUEUE(const __global Node* g_nodes,
+                        const __global int* g_edges,
+                        const __global int* g_frontier,
+                        __global int* g_next_frontier,
+                        __global int* g_counters,
+                        __global int* g_cost,
+                        const int frontier_size,
+                        const int level,
+                        __local int* l_queue,
+                        const int l_capacity){
+    __local int l_count;
+    __local int l_offset;
+    __local int l_edges;
+    __local int l_edge_end;
+
+    int tid = get_global_id(0);
+    int lid = get_local_id(0);
+
+    if(lid == 0)
+    {
+        l_count = 0;
+        l_edges = 0;
+        l_edge_end = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(tid < frontier_size)
+    {
+        int node = g_frontier[tid];
+        int start = g_nodes[node].starting;
+        int end = start + g_nodes[node].no_of_edges;
+        for(int i = start; i < end; i++)
+        {
+            int id = g_edges[i];
+            if(g_cost[id] == -1 && atomic_cmpxchg(&g_cost[id], -1, level + 1) == -1)
+            {
+                atomic_add(&l_edges, g_nodes[id].no_of_edges);
+                atomic_max(&l_edge_end, g_nodes[id].starting + g_nodes[id].no_of_edges);
+                int pos = atomic_inc(&l_count);
+                if(pos < l_capacity)
+                    l_queue[pos] = id;
+                else
+                    g_next_frontier[atomic_inc(&g_counters[0])] = id;
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(lid == 0)
+    {
+        l_count = min(l_count, l_capacity);
+        l_offset = l_count ? atomic_add(&g_counters[0], l_count) : 0;
+        if(l_edges)
+        {
+            atomic_add(&g_counters[1], l_edges);
+            atomic_max(&g_counters[2], l_edge_end);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int i = lid; i < l_count; i += get_local_size(0))
+        g_next_frontier[l_offset + i] = l_queue[i];
+}
+
+//--------------------------------------------------
+//--Top-down step over a frontier bitmap, producing the next bitmap. Used for
+//--large frontiers, where a queue costs more than one bit per vertex.
+//--g_counters has the same layout as for BFS_QUEUE.
+__kernel void BFS_BITMAP(const __global Node* g_nodes,
+                         const __global int* g_edges,
+                         const __global uint* g_frontier,
+                         __global uint* g_next_frontier,
+                         __global int* g_counters,
+                         __global int* g_cost,
+                         const int no_of_nodes,
+                         const int level){
+    __local int l_count;
+    __local int l_edges;
+    __local int l_edge_end;
+
+    int tid = get_global_id(0);
+    int lid = get_local_id(0);
+
+    if(lid == 0)
+    {
+        l_count = 0;
+        l_edges = 0;
+        l_edge_end = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(tid < no_of_nodes && ((g_frontier[tid >> 5] >> (tid & 31)) & 1))
+    {
+        int start = g_nodes[tid].starting;
+        int end = start + g_nodes[tid].no_of_edges;
+        for(int i = start; i < end; i++)
+        {
+            int id = g_edges[i];
+            if(g_cost[id] == -1 && atomic_cmpxchg(&g_cost[id], -1, level + 1) == -1)
+            {
+                atomic_or(&g_next_frontier[id >> 5], 1u << (id & 31));
+                atomic_inc(&l_count);
+                atomic_add(&l_edges, g_nodes[id].no_of_edges);
+                atomic_max(&l_edge_end, g_nodes[id].starting + g_nodes[id].no_of_edges);
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(lid == 0 && l_count)
+    {
+        atomic_add(&g_counters[0], l_count);
+        atomic_add(&g_counters[1], l_edges);
+        atomic_max(&g_counters[2], l_edge_end);
+    }
+}
+
+//--scatter a frontier queue into a (cleared) frontier bitmap
+__kernel void QUEUE_TO_BITMAP(const __global int* g_frontier,
+                              __global uint* g_bitmap,
+                              const int frontier_size){
+    int tid = get_global_id(0);
+    if(tid < frontier_size)
+    {
+        int id = g_frontier[tid];
+        atomic_or(&g_bitmap[id >> 5], 1u << (id & 31));
+    }
+}
+
+//--------------------------------------------------
+//--Stream compaction: mask -> flags -> exclusive scan -> dense index list.
+//--A mask is either one char per vertex (is_bitmap == 0) or one bit per
+//--vertex packed into uints (is_bitmap != 0).
+inline int mask_test(const __global char* g_mask, const int is_bitmap, const int i)
+{
+    if(is_bitmap)
+        return (((const __global uint*)g_mask)[i >> 5] >> (i & 31)) & 1;
+    return g_mask[i] != 0;
+}
+
+__kernel void MASK_TO_FLAGS(const __global char* g_mask,
+                            const int is_bitmap,
+                            __global int* g_flags,
+                            const int n){
+    int tid = get_global_id(0);
+    if(tid < n)
+        g_flags[tid] = mask_test(g_mask, is_bitmap, tid);
+}
+
+//--exclusive scan of each work-group's slice; the slice totals go to
+//--g_block_sums so they can be scanned and added back by SCAN_ADD.
+//--g_in and g_out may alias.
+__kernel void SCAN_LOCAL(const __global int* g_in,
+                         __global int* g_out,
+                         __global int* g_block_sums,
+                         const int n,
+                         __local int* l_tmp){
+    int tid = get_global_id(0);
+    int lid = get_local_id(0);
+    int lsize = get_local_size(0);
+
+    int x = tid < n ? g_in[tid] : 0;
+    l_tmp[lid] = x;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(int offset = 1; offset < lsize; offset <<= 1)
+    {
+        int t = lid >= offset ? l_tmp[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        l_tmp[lid] += t;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(tid < n)
+        g_out[tid] = l_tmp[lid] - x;
+    if(lid == lsize - 1)
+        g_block_sums[get_group_id(0)] = l_tmp[lid];
+}
+
+__kernel void SCAN_ADD(__global int* g_out,
+                       const __global int* g_block_offsets,
+                       const int n){
+    int tid = get_global_id(0);
+    if(tid < n)
+        g_out[tid] += g_block_offsets[get_group_id(0)];
+}
+
+__kernel void COMPACT(const __global char* g_mask,
+                      const int is_bitmap,
+                      const __global int* g_offsets,
+                      __global int* g_out,
+                      __global int* g_count,
+                      const int n){
+    int tid = get_global_id(0);
+    if(tid < n)
+    {
+        int flag = mask_test(g_mask, is_bitmap, tid);
+        if(flag)
+            g_out[g_offsets[tid]] = tid;
+        if(tid == n - 1)
+            *g_count = g_offsets[tid] + flag;
+    }
+}
+
+//--------------------------------------------------
+//--Multi-source BFS for batches of up to 32 queries: bit b of a vertex's
+//--frontier/next/seen words belongs to query b, so one pass over the
+//--frontier's adjacency lists advances every query of the batch. Query b's
+//--levels are g_cost[b * no_of_nodes .. (b + 1) * no_of_nodes).
+__kernel void MSBFS_INIT(const __global int* g_sources,
+                         __global uint* g_frontier,
+                         __global uint* g_next,
+                         __global uint* g_seen,
+                         __global int* g_cost,
+                         const int batch,
+                         const int no_of_nodes){
+    int tid = get_global_id(0);
+    if(tid < no_of_nodes)
+    {
+        uint bits = 0;
+        for(int b = 0; b < batch; b++)
+        {
+            int is_source = g_sources[b] == tid;
+            bits |= (uint)is_source << b;
+            g_cost[b * no_of_nodes + tid] = is_source ? 0 : -1;
+        }
+        g_frontier[tid] = bits;
+        g_seen[tid] = bits;
+        g_next[tid] = 0;
+    }
+}
+
+//--push every query's frontier bits to the neighbours that have not seen it
+__kernel void MSBFS_EXPAND(const __global Node* g_nodes,
+                           const __global int* g_edges,
+                           const __global uint* g_frontier,
+                           __global uint* g_next,
+                           const __global uint* g_seen,
+                           const int no_of_nodes){
+    int tid = get_global_id(0);
+    if(tid < no_of_nodes)
+    {
+        uint bits = g_frontier[tid];
+        if(bits)
+        {
+            int start = g_nodes[tid].starting;
+            int end = start + g_nodes[tid].no_of_edges;
+            for(int i = start; i < end; i++)
+            {
+                int id = g_edges[i];
+                uint discovered = bits & ~g_seen[id];
+                if(discovered)
+                    atomic_or(&g_next[id], discovered);
+            }
+        }
+    }
+}
+
+//--settle the bits discovered this level; *g_active is set if any query
+//--still has a frontier
+__kernel void MSBFS_UPDATE(__global uint* g_frontier,
+                           __global uint* g_next,
+                           __global uint* g_seen,
+                           __global int* g_cost,
+                           __global int* g_active,
+                           const int level,
+                           const int no_of_nodes){
+    int tid = get_global_id(0);
+    if(tid < no_of_nodes)
+    {
+        uint bits = g_next[tid] & ~g_seen[tid];
+        g_next[tid] = 0;
+        g_frontier[tid] = bits;
+        if(bits)
+        {
+            g_seen[tid] |= bits;
+            *g_active = 1;
+            while(bits)
+            {
+                int b = 31 - clz(bits & -bits);
+                g_cost[b * no_of_nodes + tid] = level + 1;
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------
+//--Partitioned BFS over several devices: each device owns the vertex range
+//--[begin, begin + count) and holds only its adjacency lists (offsets start
+//--at edge_base); frontier, visited and next are bitmaps over all vertices.
+//--Expand the range's frontier into g_next, skipping visited vertices.
+__kernel void PART_EXPAND(const __global Node* g_nodes,
+                          const __global int* g_edges,
+                          const __global uint* g_frontier,
+                          const __global uint* g_visited,
+                          __global uint* g_next,
+                          const int begin,
+                          const int count,
+                          const int edge_base){
+    int tid = get_global_id(0);
+    if(tid < count)
+    {
+        int v = begin + tid;
+        if(g_frontier[v >> 5] & (1u << (v & 31)))
+        {
+            int start = g_nodes[tid].starting - edge_base;
+            int end = start + g_nodes[tid].no_of_edges;
+            for(int i = start; i < end; i++)
+            {
+                int id = g_edges[i];
+                uint bit = 1u << (id & 31);
+                if(!(g_visited[id >> 5] & bit) && !(g_next[id >> 5] & bit))
+                    atomic_or(&g_next[id >> 5], bit);
+            }
+        }
+    }
+}
+
+//--after the host has merged every device's g_next into g_frontier: mark
+//--the new frontier visited, clear g_next and give the range's new vertices
+//--their level. One work item per bitmap word.
+__kernel void PART_UPDATE(const __global uint* g_frontier,
+                          __global uint* g_visited,
+                          __global uint* g_next,
+                          __global int* g_cost,
+                          const int begin,
+                          const int count,
+                          const int words,
+                          const int level){
+    int tid = get_global_id(0);
+    if(tid < words)
+    {
+        uint bits = g_frontier[tid];
+        g_visited[tid] |= bits;
+        g_next[tid] = 0;
+        while(bits)
+        {
+            int v = tid * 32 + 31 - clz(bits & -bits);
+            if(v >= begin && v < begin + count)
+                g_cost[v - begin] = level + 1;
+            bits &= bits - 1;
+        }
+    }
+}
+
+//--------------------------------------------------
+//--BFS_1 over the compressed adjacency of compressCsr (--compress):
+//--g_nodes[v].starting is the byte offset of v's list in g_bytes, which
+//--holds the zigzag delta of the first neighbour from v and then the gaps
+//--between neighbours as base-128 varints. Each work item decodes its own
+//--list while it expands it.
+//--------------------------------------------------
+__kernel void BFS_COMPRESSED(const __global Node* g_nodes,
+                             const __global uchar* g_bytes,
+                             __global char* g_mask,
+                             __global char* g_new_mask,
+                             __global char* g_visited,
+                             __global int* g_cost,
+                             __global char* done,
+                             const int no_of_nodes,
+                             __global int* g_stats){
+    __local int l_stats[2];
+
+    int tid = get_global_id(0);
+    if(g_stats)
+    {
+        if(get_local_id(0) == 0)
+        {
+            l_stats[0] = 0;
+            l_stats[1] = 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(tid < no_of_nodes && g_mask[tid])
+    {
+        if(g_stats)
+        {
+            atomic_inc(&l_stats[0]);
+            atomic_add(&l_stats[1], g_nodes[tid].no_of_edges);
+        }
+        g_mask[tid]=false;
+        const __global uchar* p = g_bytes + g_nodes[tid].starting;
+        int id = tid;
+        for(int i = 0; i < g_nodes[tid].no_of_edges; i++)
+        {
+            uint x = 0;
+            int shift = 0;
+            uchar b;
+            do
+            {
+                b = *p++;
+                x |= (uint)(b & 127) << shift;
+                shift += 7;
+            } while(b & 128);
+            id = i ? id + (int)x : tid + (int)((x >> 1) ^ -(x & 1));
+
+            if(!g_visited[id])
+            {
+                g_cost[id] = g_cost[tid] + 1;
+                g_new_mask[id] = true;
+                g_visited[id] = true;
+                *done = false;
+            }
+        }
+    }
+
+    if(g_stats)
+    {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if(get_local_id(0) == 0 && l_stats[0])
+        {
+            atomic_add(&g_stats[0], l_stats[0]);
+            atomic_add(&g_stats[1], l_stats[1]);
+        }
+    }
+}
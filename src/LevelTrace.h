@@ -0,0 +1,94 @@
+//------------------------------------------
+//--per-level traversal statistics, written as one JSON object per line
+//------------------------------------------
+#ifndef _LEVEL_TRACE_
+#define _LEVEL_TRACE_
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LevelStats
+{
+    int level;
+    const char *engine;
+    const char *direction;
+    const char *frontier_form; // "mask", "queue" or "bitmap"
+    int frontier_size;
+    long long edges;           // edges inspected: out-degree sum of the frontier
+    int discovered;            // -1: take the next level's frontier size
+    long long ns[3];           // h2d, kernel, d2h; -1 if the queue is not profiled
+};
+
+// per thread, like the engine runs that fill it; runs are numbered and
+// written across threads
+thread_local std::vector<LevelStats> level_stats;
+int level_trace_runs = 0;
+std::mutex level_trace_mutex;
+
+LevelStats newLevelStats(int level, const char *engine, const char *frontier_form)
+{
+    LevelStats stats;
+    stats.level = level;
+    stats.engine = engine;
+    stats.direction = "top-down";
+    stats.frontier_form = frontier_form;
+    stats.frontier_size = 0;
+    stats.edges = 0;
+    stats.discovered = -1;
+    stats.ns[0] = stats.ns[1] = stats.ns[2] = -1;
+    return stats;
+}
+
+//--append a record for a level that is about to run and return its index,
+//--so command times can be added once they are known
+int beginLevelStats(int level, const char *engine, const char *frontier_form, bool timed)
+{
+    LevelStats stats = newLevelStats(level, engine, frontier_form);
+    if (timed)
+        stats.ns[0] = stats.ns[1] = stats.ns[2] = 0;
+    level_stats.push_back(stats);
+    return level_stats.size() - 1;
+}
+
+static void printTraceNs(FILE *fp, const char *name, long long ns)
+{
+    if (ns < 0)
+        fprintf(fp, ",\"%s\":null", name);
+    else
+        fprintf(fp, ",\"%s\":%lld", name, ns);
+}
+
+//--write the levels collected since the last call and start a new run.
+//--path "-" writes to stdout; the file is truncated by the first run only.
+void writeLevelTrace(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(level_trace_mutex);
+    FILE *fp = path == "-" ? stdout : fopen(path.c_str(), level_trace_runs ? "a" : "w");
+    if (!fp)
+        throw(std::string("writeLevelTrace()::Error: Unable to open ") + path);
+
+    for (size_t i = 0; i < level_stats.size(); i++)
+    {
+        LevelStats &stats = level_stats[i];
+        if (stats.discovered < 0)
+            stats.discovered = i + 1 < level_stats.size() ? level_stats[i + 1].frontier_size : 0;
+
+        fprintf(fp, "{\"run\":%d,\"level\":%d,\"engine\":\"%s\",\"direction\":\"%s\",\"frontier_form\":\"%s\","
+                    "\"frontier_size\":%d,\"edges_inspected\":%lld,\"discovered\":%d",
+                level_trace_runs, stats.level, stats.engine, stats.direction, stats.frontier_form,
+                stats.frontier_size, stats.edges, stats.discovered);
+        printTraceNs(fp, "h2d_ns", stats.ns[0]);
+        printTraceNs(fp, "kernel_ns", stats.ns[1]);
+        printTraceNs(fp, "d2h_ns", stats.ns[2]);
+        fprintf(fp, "}\n");
+    }
+
+    if (fp != stdout)
+        fclose(fp);
+    level_stats.clear();
+    level_trace_runs++;
+}
+
+#endif //_LEVEL_TRACE_
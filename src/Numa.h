@@ -0,0 +1,198 @@
+//------------------------------------------
+//--NUMA placement (--numa): the CSR is split into one vertex range per
+//--memory node, balanced by edges, and the pages of every range (its
+//--adjacency lists and its share of the per-vertex arrays) are moved to
+//--that node with mbind. Where mbind is not permitted, one thread pinned to
+//--each node copies its range instead, so first touch places the pages.
+//--On a CPU OpenCL device _clInit adds one sub-device per node
+//--(CL_DEVICE_AFFINITY_DOMAIN_NUMA) and the mask engine runs each range on
+//--the matching sub-device.
+//------------------------------------------
+#ifndef _NUMA_
+#define _NUMA_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "Graph.h"
+
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+std::vector<NumaNode> numa_nodes;
+std::vector<int> numa_bounds; // vertex range i is [numa_bounds[i], numa_bounds[i + 1])
+
+//--"0-3,8-11" style list from sysfs
+static std::vector<int> numaParseList(const char *path)
+{
+    std::vector<int> list;
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return list;
+
+    int first, last;
+    char separator;
+    while (fscanf(fp, "%d", &first) == 1)
+    {
+        last = first;
+        if (fscanf(fp, "%c", &separator) == 1 && separator == '-')
+        {
+            if (fscanf(fp, "%d", &last) != 1)
+                break;
+            if (fscanf(fp, "%c", &separator) != 1)
+                separator = '\n';
+        }
+        for (int i = first; i <= last; i++)
+            list.push_back(i);
+        if (separator != ',')
+            break;
+    }
+    fclose(fp);
+    return list;
+}
+
+//--memory nodes that have cpus; a single node with every cpu if sysfs
+//--has no topology
+void numaDiscover()
+{
+    numa_nodes.clear();
+    std::vector<int> online = numaParseList("/sys/devices/system/node/online");
+    for (size_t i = 0; i < online.size(); i++)
+    {
+        NumaNode node;
+        node.id = online[i];
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node.id) + "/cpulist";
+        node.cpus = numaParseList(path.c_str());
+        if (!node.cpus.empty())
+            numa_nodes.push_back(node);
+    }
+
+    if (numa_nodes.empty())
+    {
+        NumaNode node;
+        node.id = 0;
+        for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); cpu++)
+            node.cpus.push_back(cpu);
+        numa_nodes.push_back(node);
+    }
+}
+
+//--restrict the calling thread to the cpus of a node
+bool numaPin(const NumaNode &node)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < node.cpus.size(); i++)
+        CPU_SET(node.cpus[i], &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+//--move the whole pages of [begin, end) to node; pages shared with the
+//--neighbouring range stay where they are
+static bool numaBind(const void *begin, const void *end, int node)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t first = ((size_t)begin + page - 1) / page * page;
+    size_t last = (size_t)end / page * page;
+    if (last <= first)
+        return true;
+
+    unsigned long mask[16];
+    memset(mask, 0, sizeof(mask));
+    if (node >= (int)(sizeof(mask) * 8))
+        return false;
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, (void *)first, last - first, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE) == 0;
+}
+
+//--one array to place: element i belongs to the range holding vertex i,
+//--or for the edge array to the range holding its adjacency list
+struct NumaArray
+{
+    char *base;
+    size_t element_size;
+    bool edges;
+};
+
+static void numaRange(const NumaArray &array, const Node *h_nodes, int begin, int end, char **first, char **last)
+{
+    if (array.edges)
+    {
+        int edge_begin = h_nodes[begin].starting;
+        int edge_end = h_nodes[end - 1].starting + h_nodes[end - 1].no_of_edges;
+        *first = array.base + (size_t)edge_begin * array.element_size;
+        *last = array.base + (size_t)edge_end * array.element_size;
+    }
+    else
+    {
+        *first = array.base + (size_t)begin * array.element_size;
+        *last = array.base + (size_t)end * array.element_size;
+    }
+}
+
+//--place every array by numa_bounds. Returns false if the pages could only
+//--be copied by pinned threads (mbind refused).
+bool numaPlace(const Node *h_nodes, const std::vector<NumaArray> &arrays)
+{
+    //--ranges first: h_nodes may be one of the arrays being moved
+    int parts = numa_bounds.size() - 1;
+    std::vector<char *> first(parts * arrays.size(), NULL), last(parts * arrays.size(), NULL);
+    for (int part = 0; part < parts; part++)
+        if (numa_bounds[part] < numa_bounds[part + 1])
+            for (size_t a = 0; a < arrays.size(); a++)
+                numaRange(arrays[a], h_nodes, numa_bounds[part], numa_bounds[part + 1],
+                          &first[part * arrays.size() + a], &last[part * arrays.size() + a]);
+
+    bool bound = true;
+    for (size_t r = 0; r < first.size() && bound; r++)
+        bound = numaBind(first[r], last[r], numa_nodes[r / arrays.size()].id);
+    if (bound)
+        return true;
+
+    //--first touch: copy each range out, drop its pages, and have a thread
+    //--pinned to the range's node write it back onto fresh pages
+    std::vector<std::vector<char>> copies(first.size());
+    for (size_t r = 0; r < first.size(); r++)
+        copies[r].assign(first[r], last[r]);
+
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t r = 0; r < first.size(); r++)
+    {
+        char *page_first = (char *)(((size_t)first[r] + page - 1) / page * page);
+        char *page_last = (char *)((size_t)last[r] / page * page);
+        if (page_last > page_first)
+            madvise(page_first, page_last - page_first, MADV_DONTNEED);
+    }
+
+    std::vector<std::thread> threads;
+    for (int part = 0; part < parts; part++)
+    {
+        threads.push_back(std::thread([&, part]() {
+            numaPin(numa_nodes[part]);
+            for (size_t a = 0; a < arrays.size(); a++)
+            {
+                size_t r = part * arrays.size() + a;
+                if (!copies[r].empty())
+                    memcpy(first[r], copies[r].data(), copies[r].size());
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    return false;
+}
+
+#endif //_NUMA_
@@ -0,0 +1,234 @@
+//------------------------------------------
+//--hardware counters (perf_event_open) for host-side regions: cycles,
+//--instructions, LLC and dTLB misses, and per-thread unhalted time. Every
+//--thread of the process is counted on its own, so the worker threads of a
+//--CPU OpenCL device show up separately and load imbalance becomes visible.
+//------------------------------------------
+#ifndef _PERF_COUNTERS_
+#define _PERF_COUNTERS_
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "CLHelper.h"
+
+#define PERF_EVENTS 5
+
+// Indices into PerfThread::fd/count
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_TASK_CLOCK // ns the thread was on a cpu
+};
+
+struct PerfThread
+{
+    int tid;
+    int fd[PERF_EVENTS]; // -1 if the event is not available
+    unsigned long long count[PERF_EVENTS];
+};
+
+struct PerfRegion
+{
+    std::string name;
+    std::vector<PerfThread> threads;
+};
+
+std::vector<PerfRegion> perf_regions;
+std::mutex perf_mutex; // regions may be started from several query threads
+
+static int perfOpen(int tid, PerfEvent event)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.inherit = 1; // threads the counted thread spawns later
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (event)
+    {
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_LLC_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERF_DTLB_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERF_TASK_CLOCK:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        attr.exclude_kernel = 0;
+        break;
+    }
+
+    return syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+//--scaled value of a counter, corrected for multiplexing
+static unsigned long long perfRead(int fd)
+{
+    unsigned long long values[3]; // value, time enabled, time running
+    if (fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0)
+        return 0;
+    if (values[2] < values[1])
+        return (unsigned long long)((double)values[0] * values[1] / values[2]);
+    return values[0];
+}
+
+//--counters for every thread alive right now
+static PerfRegion *perfRegion(const char *name)
+{
+    for (size_t i = 0; i < perf_regions.size(); i++)
+        if (perf_regions[i].name == name)
+            return &perf_regions[i];
+
+    PerfRegion region;
+    region.name = name;
+
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        PerfThread thread;
+        thread.tid = atoi(entry->d_name);
+        for (int e = 0; e < PERF_EVENTS; e++)
+        {
+            thread.fd[e] = perfOpen(thread.tid, (PerfEvent)e);
+            thread.count[e] = 0;
+        }
+        if (thread.fd[PERF_TASK_CLOCK] >= 0 || thread.fd[PERF_CYCLES] >= 0)
+            region.threads.push_back(thread);
+    }
+    if (dir)
+        closedir(dir);
+
+    if (region.threads.empty())
+    {
+        fprintf(stderr, "perf_event_open failed (%s), check /proc/sys/kernel/perf_event_paranoid; counters disabled\n", strerror(errno));
+        perf_counters = false;
+        return NULL;
+    }
+
+    perf_regions.push_back(region);
+    return &perf_regions.back();
+}
+
+static void perfControl(const char *name, unsigned long request)
+{
+    if (!perf_counters)
+        return;
+
+    std::lock_guard<std::mutex> lock(perf_mutex);
+    PerfRegion *region = perfRegion(name);
+    if (!region)
+        return;
+    for (size_t t = 0; t < region->threads.size(); t++)
+        for (int e = 0; e < PERF_EVENTS; e++)
+            if (region->threads[t].fd[e] >= 0)
+                ioctl(region->threads[t].fd[e], request, 0);
+}
+
+//--count into region name until perfStop(name); may be repeated, counts add up
+void perfStart(const char *name)
+{
+    perfControl(name, PERF_EVENT_IOC_ENABLE);
+}
+
+void perfStop(const char *name)
+{
+    perfControl(name, PERF_EVENT_IOC_DISABLE);
+}
+
+//--events the cpu or kernel does not support are shown as n/a
+static void perfPrintTotal(const PerfRegion &region, PerfEvent event, const char *name, const unsigned long long *total)
+{
+    bool available = false;
+    for (size_t t = 0; t < region.threads.size(); t++)
+        available |= region.threads[t].fd[event] >= 0;
+
+    if (available)
+        printf("%s %s %llu", event == PERF_CYCLES ? "" : ",", name, total[event]);
+    else
+        printf("%s %s n/a", event == PERF_CYCLES ? "" : ",", name);
+}
+
+//--print every region and close the counters
+void perfReport()
+{
+    for (size_t r = 0; r < perf_regions.size(); r++)
+    {
+        PerfRegion &region = perf_regions[r];
+        unsigned long long total[PERF_EVENTS] = {0, 0, 0, 0, 0};
+        for (size_t t = 0; t < region.threads.size(); t++)
+        {
+            for (int e = 0; e < PERF_EVENTS; e++)
+            {
+                region.threads[t].count[e] = perfRead(region.threads[t].fd[e]);
+                total[e] += region.threads[t].count[e];
+            }
+        }
+
+        printf("perf %s:", region.name.c_str());
+        perfPrintTotal(region, PERF_CYCLES, "cycles", total);
+        perfPrintTotal(region, PERF_INSTRUCTIONS, "instructions", total);
+        if (total[PERF_CYCLES] > 0)
+            printf(" (IPC %0.2f)", (double)total[PERF_INSTRUCTIONS] / total[PERF_CYCLES]);
+        perfPrintTotal(region, PERF_LLC_MISSES, "LLC misses", total);
+        perfPrintTotal(region, PERF_DTLB_MISSES, "dTLB misses", total);
+        printf("\n");
+
+        //--per-thread unhalted time; idle threads are left out
+        int active = 0;
+        unsigned long long max_clock = 0;
+        for (size_t t = 0; t < region.threads.size(); t++)
+        {
+            PerfThread &thread = region.threads[t];
+            if (thread.count[PERF_TASK_CLOCK] == 0 && thread.count[PERF_CYCLES] == 0)
+                continue;
+            active++;
+            if (thread.count[PERF_TASK_CLOCK] > max_clock)
+                max_clock = thread.count[PERF_TASK_CLOCK];
+            printf("\tthread %d: %0.3f ms unhalted, %llu cycles\n", thread.tid,
+                   thread.count[PERF_TASK_CLOCK] / 1000000.0, thread.count[PERF_CYCLES]);
+        }
+        if (active > 0 && total[PERF_TASK_CLOCK] > 0)
+            printf("\tload imbalance (max/mean unhalted time over %d threads): %0.2f\n",
+                   active, (double)max_clock * active / total[PERF_TASK_CLOCK]);
+
+        for (size_t t = 0; t < region.threads.size(); t++)
+            for (int e = 0; e < PERF_EVENTS; e++)
+                if (region.threads[t].fd[e] >= 0)
+                    close(region.threads[t].fd[e]);
+    }
+    perf_regions.clear();
+}
+
+#endif //_PERF_COUNTERS_
@@ -0,0 +1,123 @@
+//------------------------------------------
+//--command timing for --profile. Full mode waits for and times every command
+//--as it is issued; summary mode keeps the events and reads them in
+//--profileFlush(), so the queue is never drained just for measuring.
+//------------------------------------------
+#ifndef _PROFILE_
+#define _PROFILE_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "CLHelper.h"
+#include "LevelTrace.h"
+
+// Indices into a cl_ulong timers[3] array and LevelStats::ns
+enum ProfileKind
+{
+    PROFILE_H2D,
+    PROFILE_KERNEL,
+    PROFILE_D2H
+};
+
+struct PendingProfile
+{
+    cl_event event; // retained until profileFlush()
+    ProfileKind kind;
+    cl_ulong *timers;
+    int level_record; // index into level_stats, -1 for none
+};
+
+// per thread, so engines running in parallel keep their own timings
+thread_local std::vector<PendingProfile> profile_pending;
+thread_local int profile_level_record = -1; // level_stats record commands are charged to
+thread_local cl_ulong last_run_timers[3];   // totals of the last finished run
+thread_local bool profile_quiet = false; // keep printProfile() from printing
+
+static void profileAccount(cl_event event, ProfileKind kind, cl_ulong *timers, int level_record, const string *label)
+{
+    cl_ulong time_start;
+    cl_ulong time_end;
+
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
+    timers[kind] += time_end - time_start;
+    if (level_record >= 0)
+        level_stats[level_record].ns[kind] += time_end - time_start;
+
+#ifdef VERBOSE
+    if (label)
+        printf("%s took %0.8f\n", label->c_str(), (time_end - time_start) / 1000000.0);
+#else
+    (void)label;
+#endif
+}
+
+void waitAndTime(int count, cl_event *events, ProfileKind kind, cl_ulong *timers, const string *strings = NULL)
+{
+    if (profile_mode == PROFILE_OFF || count == 0)
+        return;
+
+    if (profile_mode == PROFILE_SUMMARY)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            PendingProfile pending = {events[i], kind, timers, profile_level_record};
+            clRetainEvent(events[i]);
+            profile_pending.push_back(pending);
+        }
+        return;
+    }
+
+    _clWait(count, events);
+    _clFinish();
+
+    for (int i = 0; i < count; i++)
+        profileAccount(events[i], kind, timers, profile_level_record, strings ? &strings[i] : NULL);
+}
+
+//--resolve the events summary mode has kept; call before reading the timers
+void profileFlush()
+{
+    for (size_t i = 0; i < profile_pending.size(); i++)
+    {
+        PendingProfile &pending = profile_pending[i];
+        clWaitForEvents(1, &pending.event);
+        profileAccount(pending.event, pending.kind, pending.timers, pending.level_record, NULL);
+        clReleaseEvent(pending.event);
+    }
+    profile_pending.clear();
+}
+
+//--drop the events of a run that failed before its profileFlush(): their
+//--timers live in the frame being unwound
+void profileDiscard()
+{
+    for (size_t i = 0; i < profile_pending.size(); i++)
+        clReleaseEvent(profile_pending[i].event);
+    profile_pending.clear();
+    profile_level_record = -1;
+}
+
+void printProfile(const cl_ulong *timers)
+{
+    for (int i = 0; i < 3; i++)
+        last_run_timers[i] = timers[i];
+    if (profile_mode == PROFILE_OFF || profile_quiet)
+        return;
+
+    cl_ulong h2d_timer = timers[PROFILE_H2D];
+    cl_ulong kernel_timer = timers[PROFILE_KERNEL];
+    cl_ulong d2h_timer = timers[PROFILE_D2H];
+#ifdef VERBOSE
+    printf("\tTotal h2d time is: %0.3f milliseconds \n", (h2d_timer) / 1000000.0);
+    printf("\tTotal kernel time is: %0.3f milliseconds \n", (kernel_timer) / 1000000.0);
+    printf("\tTotal d2h time is: %0.3f milliseconds \n", (d2h_timer) / 1000000.0);
+    printf("\tTotal time: %0.3f milliseconds \n", (h2d_timer + kernel_timer + d2h_timer) / 1000000.0);
+#else
+    printf("%0.3f %0.3f %0.3f %0.3f\n", (h2d_timer) / 1000000.0, (kernel_timer) / 1000000.0, (d2h_timer) / 1000000.0, (h2d_timer + kernel_timer + d2h_timer) / 1000000.0);
+#endif
+}
+
+#endif //_PROFILE_
@@ -0,0 +1,387 @@
+//------------------------------------------
+//--query server (--serve <socket>): the graph is parsed and uploaded once,
+//--then BFS queries arrive over a Unix stream socket. Queries of all
+//--clients go into one queue; the device thread takes up to a batch's worth
+//--at a time and runs them as one multi-source traversal
+//--(run_bfs_opencl_batch), so concurrent clients share device passes. With
+//----fission every sub-device has a device thread of its own.
+//--
+//--Protocol, native byte order, any number of requests per connection:
+//--  request: ServeRequest, then count ServeQuery records
+//--  reply:   for every query, in order, a ServeReply followed by
+//--           reply.payload ints (levels or parents of every vertex)
+//------------------------------------------
+#ifndef _SERVER_
+#define _SERVER_
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Engines.h"
+
+#define SERVE_MAGIC 0x51534642 // "BFSQ"
+#define SERVE_MAX_QUERIES 4096 // per request
+
+enum ServeOutput
+{
+    SERVE_LEVELS,  // level of every vertex, -1 if not reached
+    SERVE_PARENTS, // BFS tree, the source is its own parent
+    SERVE_STATS    // ServeReply only
+};
+
+struct ServeRequest
+{
+    unsigned int magic;
+    unsigned int count;
+};
+
+struct ServeQuery
+{
+    int source;
+    int max_depth; // levels to expand, -1 for no limit
+    int output;    // ServeOutput
+};
+
+struct ServeReply
+{
+    int status;  // 0, or -1 for an invalid query (no payload)
+    int depth;   // number of levels reached
+    int reached; // vertices with a level
+    int payload; // ints following the reply
+    long long edges_traversed;
+};
+
+struct ServeClient
+{
+    int fd;
+    std::mutex write_mutex;
+
+    explicit ServeClient(int fd) : fd(fd) {}
+    ~ServeClient() { close(fd); } // once the reader and every pending query let go
+};
+
+struct ServeTask
+{
+    std::shared_ptr<ServeClient> client;
+    ServeQuery query;
+};
+
+std::mutex serve_mutex;
+std::condition_variable serve_ready;
+std::deque<ServeTask> serve_queue;
+volatile sig_atomic_t serve_stop = 0;
+
+static void serveSignal(int)
+{
+    serve_stop = 1;
+}
+
+static bool readFully(int fd, void *buffer, size_t size)
+{
+    char *p = (char *)buffer;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t size)
+{
+    const char *p = (const char *)buffer;
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+//--one thread per connection: queue its queries until it hangs up or
+//--sends something that is not a request
+static void serveClient(std::shared_ptr<ServeClient> client)
+{
+    std::vector<ServeQuery> queries;
+    for (;;)
+    {
+        ServeRequest request;
+        if (!readFully(client->fd, &request, sizeof(request)) ||
+            request.magic != SERVE_MAGIC || request.count > SERVE_MAX_QUERIES)
+            break;
+
+        queries.resize(request.count);
+        if (!readFully(client->fd, queries.data(), request.count * sizeof(ServeQuery)))
+            break;
+
+        std::lock_guard<std::mutex> lock(serve_mutex);
+        for (size_t i = 0; i < queries.size(); i++)
+            serve_queue.push_back(ServeTask{client, queries[i]});
+        serve_ready.notify_one();
+    }
+    shutdown(client->fd, SHUT_RD);
+}
+
+static void serveAccept(int listen_fd)
+{
+    for (;;)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return; // listening socket shut down
+        }
+        std::thread(serveClient, std::make_shared<ServeClient>(fd)).detach();
+    }
+}
+
+//--answer one query from its row of the batch's level arrays; levels and
+//--parents of a reordered graph go back to input ids (new_id non-empty)
+static void serveReply(const ServeTask &task, int no_of_nodes, const Node *h_nodes, const int *h_edges,
+                       int *h_cost, std::vector<int> &h_parents, const std::vector<int> &new_id,
+                       const std::vector<int> &old_id)
+{
+    const ServeQuery &query = task.query;
+    ServeReply reply;
+    memset(&reply, 0, sizeof(reply));
+    const int *payload = NULL;
+
+    if (h_cost)
+    {
+        for (int v = 0; v < no_of_nodes; v++)
+        {
+            //--the batch ran to the deepest query's limit
+            if (query.max_depth >= 0 && h_cost[v] > query.max_depth)
+                h_cost[v] = -1;
+            if (h_cost[v] < 0)
+                continue;
+            reply.reached++;
+            reply.edges_traversed += h_nodes[v].no_of_edges;
+            reply.depth = std::max(reply.depth, h_cost[v] + 1);
+        }
+
+        if (query.output == SERVE_LEVELS)
+        {
+            if (!new_id.empty())
+                unpermute(no_of_nodes, new_id.data(), h_cost);
+            payload = h_cost;
+        }
+        else if (query.output == SERVE_PARENTS)
+        {
+            h_parents.resize(no_of_nodes);
+            int source = new_id.empty() ? query.source : new_id[query.source];
+            bfsParents(no_of_nodes, h_nodes, h_edges, h_cost, source, h_parents.data());
+            if (!new_id.empty())
+                unpermute(no_of_nodes, new_id.data(), h_parents.data(), old_id.data());
+            payload = h_parents.data();
+        }
+        reply.payload = payload ? no_of_nodes : 0;
+    }
+    else
+        reply.status = -1;
+
+    std::lock_guard<std::mutex> lock(task.client->write_mutex);
+    if (writeFully(task.client->fd, &reply, sizeof(reply)) && payload)
+        writeFully(task.client->fd, payload, reply.payload * sizeof(int));
+}
+
+//--device loop: take everything that queued up while the device was busy,
+//--up to a batch, run it and answer it, until serve_stop
+static void serveDevice(ResidentGraph *graph, Node *h_nodes, int *h_edges, const std::vector<int> &new_id,
+                        bool trace, std::atomic<long long> *queries, std::atomic<long long> *batches)
+{
+    std::vector<int> old_id(new_id.size());
+    for (size_t v = 0; v < new_id.size(); v++)
+        old_id[new_id[v]] = v;
+    int no_of_nodes = graph->no_of_nodes;
+    std::vector<int> h_cost((size_t)graph->capacity * no_of_nodes);
+    std::vector<int> h_parents;
+    std::vector<ServeTask> tasks;
+    std::vector<int> sources;
+    while (!serve_stop)
+    {
+        tasks.clear();
+        {
+            std::unique_lock<std::mutex> lock(serve_mutex);
+            if (serve_queue.empty())
+            {
+                serve_ready.wait_for(lock, std::chrono::milliseconds(100));
+                continue;
+            }
+
+            while (!serve_queue.empty() && (int)tasks.size() < graph->capacity)
+            {
+                tasks.push_back(serve_queue.front());
+                serve_queue.pop_front();
+            }
+            //--leave the rest to another device
+            if (!serve_queue.empty())
+                serve_ready.notify_one();
+        }
+
+        sources.clear();
+        int max_depth = 0;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            const ServeQuery &query = tasks[i].query;
+            if (query.source < 0 || query.source >= no_of_nodes)
+                continue;
+            sources.push_back(new_id.empty() ? query.source : new_id[query.source]);
+            if (max_depth >= 0)
+                max_depth = query.max_depth < 0 ? -1 : std::max(max_depth, query.max_depth);
+        }
+
+        if (!sources.empty())
+        {
+            if (trace)
+                traceBegin("batch");
+            run_bfs_opencl_batch(graph, sources.size(), sources.data(), max_depth, h_cost.data());
+            if (trace)
+                traceEnd();
+            (*batches)++;
+        }
+
+        int row = 0;
+        for (size_t i = 0; i < tasks.size(); i++)
+        {
+            const ServeQuery &query = tasks[i].query;
+            bool valid = query.source >= 0 && query.source < no_of_nodes;
+            int *cost = valid ? &h_cost[(size_t)row++ * no_of_nodes] : NULL;
+            serveReply(tasks[i], no_of_nodes, h_nodes, h_edges, cost, h_parents, new_id, old_id);
+        }
+        *queries += tasks.size();
+    }
+}
+
+//----------------------------------------------------------
+//--serve queries on path until SIGINT or SIGTERM, on the calling thread's
+//--OpenCL environment, or with device fission on every environment of
+//--split at once (one device thread and one copy of the graph each).
+//--Queries name input vertices; new_id maps them into a reordered graph.
+//----------------------------------------------------------
+void serve(const char *path, int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges,
+           std::vector<CLEnvironment> &split, const std::vector<int> &new_id)
+{
+    std::vector<CLEnvironment *> devices;
+    if (split.empty())
+        devices.push_back(cl_env);
+    for (size_t d = 0; d < split.size(); d++)
+        devices.push_back(&split[d]);
+
+    //--buffers that fail half way stay in the environment's pool
+    std::vector<ResidentGraph> graphs(devices.size());
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        CLBinding binding(*devices[d]);
+        createResidentGraph(no_of_nodes, h_nodes, no_of_edges, h_edges, &graphs[d]);
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        throw(string("serve()::Error: socket path too long: ") + path);
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0)
+    {
+        string error = strerror(errno);
+        if (listen_fd >= 0)
+            close(listen_fd);
+        throw(string("serve()::Error: Unable to listen on ") + path + ": " + error);
+    }
+
+    serve_stop = 0;
+    signal(SIGINT, serveSignal);
+    signal(SIGTERM, serveSignal);
+    std::thread acceptor(serveAccept, listen_fd);
+    printf("Serving %d nodes on %s, up to %d queries per batch on %d device(s)\n", no_of_nodes, path,
+           graphs[0].capacity, (int)devices.size());
+    fflush(stdout);
+
+    std::atomic<long long> queries(0), batches(0);
+    std::mutex error_mutex;
+    string error;
+    size_t group_size = work_group_size;
+    ProfileMode mode = profile_mode;
+    bool quiet = profile_quiet;
+    auto device_loop = [&](size_t d) {
+        CLBinding binding(*devices[d]);
+        work_group_size = group_size;
+        profile_mode = mode;
+        profile_quiet = quiet;
+        try
+        {
+            serveDevice(&graphs[d], h_nodes, h_edges, new_id, devices.size() == 1, &queries, &batches);
+        }
+        catch (std::string msg)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (error.empty())
+                error = msg;
+            serve_stop = 1;
+        }
+    };
+
+    if (devices.size() == 1)
+        device_loop(0);
+    else
+    {
+        std::vector<std::thread> threads;
+        for (size_t d = 0; d < devices.size(); d++)
+            threads.push_back(std::thread(device_loop, d));
+        for (size_t d = 0; d < threads.size(); d++)
+            threads[d].join();
+    }
+
+    shutdown(listen_fd, SHUT_RDWR);
+    acceptor.join();
+    close(listen_fd);
+    unlink(path);
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        CLBinding binding(*devices[d]);
+        releaseResidentGraph(&graphs[d]);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (!error.empty())
+        throw("in serve -> " + error);
+
+    printf("Served %lld queries in %lld batches (%0.1f per batch)\n", queries.load(), batches.load(),
+           batches ? (double)queries / batches : 0.0);
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        CLBinding binding(*devices[d]);
+        _clPoolReport();
+    }
+}
+
+#endif //_SERVER_
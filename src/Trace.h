@@ -0,0 +1,239 @@
+//------------------------------------------
+//--timeline of OpenCL commands and host phases in Chrome trace format
+//--(chrome://tracing, ui.perfetto.dev)
+//------------------------------------------
+#ifndef _TRACE_
+#define _TRACE_
+
+#include <CL/cl.h>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceCommand
+{
+    std::string name;
+    const char *category;      // "h2d", "kernel", "d2h", ...
+    cl_event event;            // retained until traceCollect()
+    int queue;                 // index into trace_queues, set by traceCollect()
+    unsigned long long host_ns; // host clock right after the enqueue
+    cl_ulong queued, submit, start, end;
+};
+
+//--a command queue seen in the trace. Each queue is aligned with the host
+//--clock on its own and gets its own rows under its device.
+struct TraceQueue
+{
+    cl_command_queue queue; // retained until writeTrace() so the handle is not reused
+    int device;             // index into trace_devices
+};
+
+struct TraceDevice
+{
+    cl_device_id device;
+    std::string name;
+};
+
+struct TracePhase
+{
+    std::string name;
+    unsigned long long start_ns, end_ns;
+};
+
+bool tracing = false;
+std::string trace_file;
+
+std::vector<TraceCommand> trace_commands;
+std::vector<TraceQueue> trace_queues;
+std::vector<TraceDevice> trace_devices;
+std::vector<TracePhase> trace_phases;
+std::vector<TracePhase> trace_open_phases;
+size_t trace_collected = 0; // trace_commands[0, trace_collected) are resolved
+std::mutex trace_mutex;      // commands may be recorded from several threads
+
+unsigned long long traceNow()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//--remember an enqueued command; its timestamps are read in traceCollect()
+void traceCommand(cl_event event, const char *category, const std::string &name)
+{
+    if (!tracing || event == NULL)
+        return;
+
+    TraceCommand command;
+    command.name = name;
+    command.category = category;
+    command.event = event;
+    command.queue = -1;
+    command.host_ns = traceNow();
+    command.queued = command.submit = command.start = command.end = 0;
+    clRetainEvent(event);
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_commands.push_back(command);
+}
+
+void traceBegin(const char *name)
+{
+    if (!tracing)
+        return;
+
+    TracePhase phase;
+    phase.name = name;
+    phase.start_ns = traceNow();
+    phase.end_ns = 0;
+    trace_open_phases.push_back(phase);
+}
+
+void traceEnd()
+{
+    if (!tracing || trace_open_phases.empty())
+        return;
+
+    TracePhase phase = trace_open_phases.back();
+    trace_open_phases.pop_back();
+    phase.end_ns = traceNow();
+    trace_phases.push_back(phase);
+}
+
+//--index of a queue in trace_queues, adding it and its device when new
+static int traceQueue(cl_command_queue queue)
+{
+    for (size_t i = 0; i < trace_queues.size(); i++)
+        if (trace_queues[i].queue == queue)
+            return (int)i;
+
+    TraceQueue entry;
+    entry.queue = queue;
+    entry.device = -1;
+    clRetainCommandQueue(queue);
+
+    cl_device_id device = NULL;
+    clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+    for (size_t i = 0; i < trace_devices.size(); i++)
+        if (trace_devices[i].device == device)
+            entry.device = (int)i;
+    if (entry.device < 0)
+    {
+        char name[256] = "";
+        clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+        TraceDevice found;
+        found.device = device;
+        found.name = name;
+        entry.device = (int)trace_devices.size();
+        trace_devices.push_back(found);
+    }
+    trace_queues.push_back(entry);
+    return (int)trace_queues.size() - 1;
+}
+
+//--wait for the traced commands, read their profiling timestamps and release
+//--them. Must run while the context is still alive.
+void traceCollect()
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (; trace_collected < trace_commands.size(); trace_collected++)
+    {
+        TraceCommand &command = trace_commands[trace_collected];
+        clWaitForEvents(1, &command.event);
+        clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &command.queued, NULL);
+        clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &command.submit, NULL);
+        clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &command.start, NULL);
+        clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &command.end, NULL);
+        cl_command_queue queue = NULL;
+        clGetEventInfo(command.event, CL_EVENT_COMMAND_QUEUE, sizeof(cl_command_queue), &queue, NULL);
+        command.queue = traceQueue(queue);
+        clReleaseEvent(command.event);
+        command.event = NULL;
+    }
+}
+
+static void writeTraceSlice(FILE *fp, const char *name, const char *category, int pid, int tid,
+                            double start_us, double end_us)
+{
+    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            name, category, pid, tid, start_us, end_us > start_us ? end_us - start_us : 0.0);
+}
+
+//--write everything recorded so far and release the traced queues. Device
+//--timestamps are moved onto the host clock per queue, using the smallest
+//--(enqueue - QUEUED) difference seen on that queue: queues on different
+//--devices or contexts need not share a clock. pid 0 holds host phases and
+//--pid 1 + d device d. Queue q has tid 3q for executing commands, 3q + 1 for
+//--their queued-to-submit and 3q + 2 for their submit-to-start intervals.
+void writeTrace(const std::string &path)
+{
+    traceCollect();
+
+    FILE *fp = fopen(path.c_str(), "w");
+    if (!fp)
+        throw(std::string("writeTrace()::Error: Unable to open ") + path);
+
+    unsigned long long origin = ~0ULL;
+    std::vector<long long> offset(trace_queues.size(), 0);
+    std::vector<bool> offset_set(trace_queues.size(), false);
+    for (size_t i = 0; i < trace_phases.size(); i++)
+        origin = std::min(origin, trace_phases[i].start_ns);
+    for (size_t i = 0; i < trace_commands.size(); i++)
+    {
+        int q = trace_commands[i].queue;
+        long long diff = (long long)trace_commands[i].host_ns - (long long)trace_commands[i].queued;
+        if (!offset_set[q] || diff < offset[q])
+            offset[q] = diff;
+        offset_set[q] = true;
+    }
+    for (size_t i = 0; i < trace_commands.size(); i++)
+        origin = std::min(origin, (unsigned long long)(trace_commands[i].queued + offset[trace_commands[i].queue]));
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    fprintf(fp, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"host\"}}");
+    for (size_t d = 0; d < trace_devices.size(); d++)
+        fprintf(fp, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"device %d: %s\"}}",
+                (int)d + 1, (int)d, trace_devices[d].name.c_str());
+    for (size_t q = 0; q < trace_queues.size(); q++)
+    {
+        static const char *rows[3] = {"running", "queued", "submitted"};
+        for (int row = 0; row < 3; row++)
+            fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"queue %d %s\"}}",
+                    trace_queues[q].device + 1, 3 * (int)q + row, (int)q, rows[row]);
+    }
+
+    for (size_t i = 0; i < trace_phases.size(); i++)
+    {
+        TracePhase &phase = trace_phases[i];
+        writeTraceSlice(fp, phase.name.c_str(), "host", 0, 0,
+                        (phase.start_ns - origin) / 1000.0, (phase.end_ns - origin) / 1000.0);
+    }
+    for (size_t i = 0; i < trace_commands.size(); i++)
+    {
+        TraceCommand &command = trace_commands[i];
+        long long shift = offset[command.queue] - (long long)origin;
+        double queued = ((long long)command.queued + shift) / 1000.0;
+        double submit = ((long long)command.submit + shift) / 1000.0;
+        double start = ((long long)command.start + shift) / 1000.0;
+        double end = ((long long)command.end + shift) / 1000.0;
+        int pid = trace_queues[command.queue].device + 1;
+        int tid = 3 * command.queue;
+        writeTraceSlice(fp, command.name.c_str(), command.category, pid, tid + 1, queued, submit);
+        writeTraceSlice(fp, command.name.c_str(), command.category, pid, tid + 2, submit, start);
+        writeTraceSlice(fp, command.name.c_str(), command.category, pid, tid, start, end);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    for (size_t q = 0; q < trace_queues.size(); q++)
+        clReleaseCommandQueue(trace_queues[q].queue);
+    trace_queues.clear();
+    trace_devices.clear();
+    trace_commands.clear();
+    trace_collected = 0;
+}
+
+#endif //_TRACE_
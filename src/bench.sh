@@ -0,0 +1,91 @@
+#!/bin/sh
+#----------------------------------------------------------
+#--benchmark suite: synthetic graphs x engines x work-group sizes x memory
+#--modes on the CPU OpenCL device, one CSV row per configuration.
+#--Every variable below can be overridden from the environment, e.g.
+#--  GRAPHS="kron:16:16" ENGINES=queue RUNS=5 ./bench.sh
+#--With a baseline CSV present, rows whose median end-to-end time grew by
+#--more than THRESHOLD (a fraction) are reported and the script fails.
+#----------------------------------------------------------
+EXE=${EXE:-../bin/bfs}
+GENGRAPH=${GENGRAPH:-../bin/gengraph}
+DATA=${DATA:-../data/synthetic}
+OUT=${OUT:-bench.csv}
+BASELINE=${BASELINE:-bench_baseline.csv}
+THRESHOLD=${THRESHOLD:-0.10}
+
+GRAPHS=${GRAPHS:-"kron:14:16 kron:18:16 grid:256:256 grid:1024:1024 random:65536:1048576"}
+ENGINES=${ENGINES:-"mask queue adaptive hybrid"}
+WORK_GROUP_SIZES=${WORK_GROUP_SIZES:-"64 128 256"}
+MEMORY_MODES=${MEMORY_MODES:-"copy zerocopy"}
+RUNS=${RUNS:-10}
+WARMUP=${WARMUP:-2}
+
+mkdir -p "$DATA" || exit 1
+rm -f "$OUT"
+
+for spec in $GRAPHS; do
+    type=${spec%%:*}
+    rest=${spec#*:}
+    a=${rest%%:*}
+    b=${rest#*:}
+    graph="$DATA/$type-$a-$b.mtx"
+    if [ ! -f "$graph" ]; then
+        echo "generating $graph"
+        "$GENGRAPH" "$type" "$a" "$b" "$graph" || exit 1
+    fi
+
+    for engine in $ENGINES; do
+        for wg in $WORK_GROUP_SIZES; do
+            for memory in $MEMORY_MODES; do
+                echo "$graph engine=$engine wg=$wg memory=$memory"
+                log=$("$EXE" "$graph" -c -e "$engine" -g "$wg" --memory "$memory" \
+                      -i "$RUNS" --warmup "$WARMUP" --bench csv --bench-out "$OUT" 2>&1)
+                status=$?
+                if [ $status -ne 0 ] || echo "$log" | grep -q -e "failed" -e "exception"; then
+                    echo "$log"
+                    echo "FAILED: $graph engine=$engine wg=$wg memory=$memory"
+                    exit 1
+                fi
+            done
+        done
+    done
+done
+
+echo "results in $OUT"
+
+if [ ! -f "$BASELINE" ]; then
+    echo "no baseline $BASELINE, skipping regression check (make bench-baseline stores one)"
+    exit 0
+fi
+
+#--match rows on graph/device/engine/work_group_size/memory, compare medians
+awk -F, -v threshold="$THRESHOLD" '
+    FNR == 1 {
+        for (i = 1; i <= NF; i++)
+            if ($i == "e2e_ms_median")
+                col = i
+        next
+    }
+    {
+        key = $1 "," $2 "," $3 "," $4 "," $5
+    }
+    FILENAME == ARGV[1] {
+        base[key] = $col
+        next
+    }
+    key in base && base[key] > 0 {
+        ratio = $col / base[key]
+        if (ratio > 1 + threshold) {
+            printf("REGRESSION %s: %.3f ms -> %.3f ms (%+.1f%%)\n", key, base[key], $col, (ratio - 1) * 100)
+            regressions++
+        }
+    }
+    END {
+        if (regressions) {
+            printf("%d configuration(s) slower than baseline by more than %.0f%%\n", regressions, threshold * 100)
+            exit 1
+        }
+        print "no regressions against baseline"
+    }
+' "$BASELINE" "$OUT"
@@ -3,12 +3,11 @@
 #include <iostream>
 #include <string>
 #include <cstring>
-#include <unordered_set>
-#include <sys/time.h>
 
-#include "CLHelper.h"
-#include "util.h"
-#include "matrixmarket/mmio.h"
+#include "Engines.h"
+#include "Bench.h"
+#include "Server.h"
+#include "Distributed.h"
 
 #define MAX_THREADS_PER_BLOCK 256
 
@@ -16,397 +15,337 @@ int iterations = 1;
 int source = 0;
 bool undirected = false;
 
-typedef unsigned long long timestamp_t;
-
-static timestamp_t get_timestamp ()
-{
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    return  now.tv_usec + (timestamp_t)now.tv_sec * 1000000;
-}
-
-struct Node
-{
-    int starting;
-    int no_of_edges;
-};
-
-//----------------------------------------------------------
-//--Reference bfs on cpu
-//--programmer:	jianbin
-//--date:	26/01/2011
-//--note: width is changed to the new_width
-//----------------------------------------------------------
-void run_bfs_cpu(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, char* h_mask, char* h_new_mask, char* h_visited, int *h_cost_ref)
-{
-#ifdef PROFILING
-    timestamp_t t0 = get_timestamp();
-#endif
-
-    int amtloops = 0;
-    char shouldContinue;
-    do
-    {
-        amtloops++;
-        shouldContinue = false;
-        for (int tid = 0; tid < no_of_nodes; tid++)
-        {
-            if (h_mask[tid])
-            {
-                h_mask[tid] = false;
-                for (int i = h_nodes[tid].starting; i < h_nodes[tid].starting + h_nodes[tid].no_of_edges; i++)
-                {
-                    int id = h_edges[i]; //--cambine: node id is connected with node tid
-                    if (!h_visited[id])
-                    {
-                        h_cost_ref[id] = h_cost_ref[tid] + 1;
-                        h_new_mask[id] = true;
-                    }
-                }
-            }
-        }
-
-        for (int tid = 0; tid < no_of_nodes; tid++)
-        {
-            if (h_new_mask[tid] == true)
-            {
-                h_mask[tid] = true;
-                h_visited[tid] = true;
-                shouldContinue = true;
-                h_new_mask[tid] = false;
-            }
-        }
-    } while (shouldContinue);
-
-#ifdef VERBOSE
-    printf("Took %d loops\n", amtloops);
-#endif
-#ifdef PROFILING
-    timestamp_t t1 = get_timestamp();
-    double secs = (t1 - t0) / 1000.0L;
-    std::cout << "\treference time (sequential)(ms):" << secs << std::endl;
-#endif
-}
-
-void waitAndTime(int count, cl_event* events, string* strings, cl_ulong* timer)
-{
-    _clWait(count, events);
-    _clFinish();
-       
-    for(int i = 0; i < count; i++) {
-        cl_ulong time_start;
-        cl_ulong time_end;
-
-        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
-        *timer += time_end - time_start;
-            
-#ifdef VERBOSE
-        printf("%s took %0.8f\n", strings[i].c_str(), (time_end - time_start) / 1000000.0);
-#endif
-    }
-}
-
-void waitAndTime(int count, cl_event* events, cl_ulong* timer)
-{
-    _clWait(count, events);
-    _clFinish();
-       
-    for(int i = 0; i < count; i++) {
-        cl_ulong time_start;
-        cl_ulong time_end;
-
-        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(time_start), &time_start, NULL);
-        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(time_end), &time_end, NULL);
-        *timer += time_end - time_start;
-    }
-}
-
-//----------------------------------------------------------
-//--breadth first search on the OpenCL device
-//----------------------------------------------------------
-void run_bfs_opencl(int no_of_nodes, Node *h_nodes, int no_of_edges, int *h_edges, char *h_mask, char *h_new_mask, char *h_visited, int *h_cost)
-{
-    char h_done = true;
-    cl_mem d_nodes, d_edges, d_mask, d_new_mask, d_visited, d_cost, d_done;
-
-#ifdef PROFILING
-    cl_ulong kernel_timer = 0;
-    cl_ulong h2d_timer = 0;
-    cl_ulong d2h_timer = 0;
-#endif
-
-    try
-    {
-        //--1 transfer data from host to device
-        d_nodes = _clMallocRW(no_of_nodes * sizeof(Node));
-        d_edges = _clMallocRW(no_of_edges * sizeof(int));
-        d_mask = _clMallocRW(no_of_nodes * sizeof(char));
-        d_new_mask = _clMallocRW(no_of_nodes * sizeof(char));
-        d_visited = _clMallocRW(no_of_nodes * sizeof(char));
-
-        d_cost = _clMallocRW(no_of_nodes * sizeof(int));
-        d_done = _clMallocRW(sizeof(char));
-
-        cl_event h2dpreevents[6];
-        h2dpreevents[0] = _clMemcpyH2D(d_nodes, no_of_nodes * sizeof(Node), h_nodes);
-        h2dpreevents[1] = _clMemcpyH2D(d_edges, no_of_edges * sizeof(int), h_edges);
-        h2dpreevents[2] = _clMemcpyH2D(d_mask, no_of_nodes * sizeof(char), h_mask);
-        h2dpreevents[3] = _clMemcpyH2D(d_new_mask, no_of_nodes * sizeof(char), h_new_mask);
-        h2dpreevents[4] = _clMemcpyH2D(d_visited, no_of_nodes * sizeof(char), h_visited);
-        h2dpreevents[5] = _clMemcpyH2D(d_cost, no_of_nodes * sizeof(int), h_cost);
-
-#ifdef PROFILING
-        waitAndTime(6, h2dpreevents, &h2d_timer);
-#endif
-        //--2 invoke kernel
-        int amtloops = 0;
-
-        cl_event h2devents[1];
-        cl_event kernelevents[1];
-        string kernelstrings[1];
-        cl_event d2hevents[1];
-        do
-        {
-            amtloops++;
-
-            h_done = true; 
-            h2devents[0] = _clMemcpyH2D(d_done, sizeof(char), &h_done);
-
-#ifdef PROFILING
-            waitAndTime(1, h2devents, &h2d_timer);
-#endif
-            clReleaseEvent(h2devents[0]);
-
-            //--kernel 0
-            int kernel_id = 0;
-            int kernel_idx = 0;
-            _clSetArgs(kernel_id, kernel_idx++, d_nodes);
-            _clSetArgs(kernel_id, kernel_idx++, d_edges);
-            _clSetArgs(kernel_id, kernel_idx++, d_mask);
-            _clSetArgs(kernel_id, kernel_idx++, d_new_mask);
-            _clSetArgs(kernel_id, kernel_idx++, d_visited);
-            _clSetArgs(kernel_id, kernel_idx++, d_cost);
-            _clSetArgs(kernel_id, kernel_idx++, d_done);
-            _clSetArgs(kernel_id, kernel_idx++, &no_of_nodes, sizeof(int));
-
-            //int work_items = no_of_nodes;
-            kernelstrings[0] = "Top_Down cycle w/ size: unknown"; 
-            kernelevents[0] = _clInvokeKernel(kernel_id, no_of_nodes, work_group_size);
-#ifdef PROFILING
-            waitAndTime(1, kernelevents, kernelstrings, &kernel_timer);
-#endif
-            clReleaseEvent(kernelevents[0]);
-
-            d2hevents[0] = _clMemcpyD2H(d_done, sizeof(char), &h_done);
-#ifdef PROFILING
-            waitAndTime(1, d2hevents, &d2h_timer);
-#endif
-            clReleaseEvent(d2hevents[0]);
-            
-            cl_mem tmp = d_mask;
-            d_mask = d_new_mask;
-            d_new_mask = tmp;
-        } while (!h_done);
-
-#ifdef VERBOSE
-        printf("Took %d loops\n", amtloops);
-#endif
-        _clFinish();
-
-        //--3 transfer data from device to host
-        cl_event d2hevent[1];
-        d2hevent[0] = _clMemcpyD2H(d_cost, no_of_nodes * sizeof(int), h_cost);
-
-#ifdef PROFILING
-        waitAndTime(1, d2hevent, &d2h_timer);
-#endif
-        clReleaseEvent(d2hevent[0]);
-    }
-    catch (std::string msg)
-    {
-        throw("in run_bfs_opencl -> " + msg);
-    }
-
-    //--4 release cl resources.
-    _clFree(d_nodes);
-    _clFree(d_edges);
-    _clFree(d_mask);
-    _clFree(d_new_mask);
-    _clFree(d_visited);
-    _clFree(d_cost);
-    _clFree(d_done);
-
-#ifdef PROFILING
-    
-    #ifdef VERBOSE
-    printf("\tTotal h2d time is: %0.3f milliseconds \n", (h2d_timer) / 1000000.0);
-    printf("\tTotal kernel time is: %0.3f milliseconds \n", (kernel_timer) / 1000000.0);
-    printf("\tTotal d2h time is: %0.3f milliseconds \n", (d2h_timer) / 1000000.0);
-    printf("\tTotal time: %0.3f milliseconds \n", (h2d_timer + kernel_timer + d2h_timer) / 1000000.0);
-    #else
-    printf("%0.3f %0.3f %0.3f %0.3f\n", (h2d_timer) / 1000000.0, (kernel_timer) / 1000000.0, (d2h_timer) / 1000000.0, (h2d_timer + kernel_timer + d2h_timer) / 1000000.0);
-    #endif
-#endif
-}
-
 int main(int argc, char *argv[])
 {
-    MM_typecode matcode;
-
     int no_of_nodes;
+    int no_of_edges;
 
-    Node *h_nodes;
-    char *h_mask;
-    char *h_new_mask;
-    char *h_visited;
-    int *h_edges;
-    int *I;
-    int *J;
-    double *val;
+    Node *h_nodes = NULL;
+    char *h_mask = NULL;
+    char *h_new_mask = NULL;
+    char *h_visited = NULL;
+    int *h_edges = NULL;
+    Arena arena; // every host array below, released with one unmap per chunk
+    void *csr_mapping = NULL; // graph and its size when mapped from a .csr file
+    size_t csr_mapping_size = 0;
 
     try
     {
+#ifdef USE_MPI
+        mpiInit(&argc, &argv);
+#endif
         if (argc < 2)
         {
             fprintf(stderr, "Usage: %s <input_file>\n", argv[0]);
             fprintf(stderr, "Flags:\n");
-            fprintf(stderr, "\t-g <int>: work group size.\n");
+            fprintf(stderr, "\t-g <int>: work group size (def min(nodes, 256)).\n");
             fprintf(stderr, "\t-d <int>: device id to use.\n");
             fprintf(stderr, "\t-c: use cpu instead of gpu.\n");
+            fprintf(stderr, "\t-e <mask|queue|adaptive|hybrid|partitioned|external>: traversal engine (def mask).\n");
+            fprintf(stderr, "\t--to-dense <int>: adaptive engine uses a bitmap above edges/value frontier edges (def 20).\n");
+            fprintf(stderr, "\t--to-sparse <int>: adaptive engine uses a queue below nodes/value frontier vertices (def 50).\n");
+            fprintf(stderr, "\t--to-device <int>: hybrid engine moves to the device above edges/value frontier edges (def 100).\n");
+            fprintf(stderr, "\t--to-host <int>: hybrid engine moves back to the host below edges/value frontier edges (def 400).\n");
             fprintf(stderr, "\t-s <int>: use value as source node (def 0).\n");
             fprintf(stderr, "\t-i <int>: use amount of iterations (def 1).\n");
+            fprintf(stderr, "\t--memory <copy|zerocopy|auto>: copy buffers to the device or map host memory (def copy).\n");
+            fprintf(stderr, "\t--level-trace <file>: write per-level statistics as JSON lines, - for stdout.\n");
+            fprintf(stderr, "\t--trace <file>: write a Chrome/Perfetto timeline of OpenCL commands and host phases.\n");
+            fprintf(stderr, "\t--profile <off|summary|full>: no timing, totals read at the end of a run, or per-command timing that serializes the queue (def off, full in profile builds).\n");
+            fprintf(stderr, "\t--bench <csv|json>: print min/median/p90/p99/stddev of end-to-end, kernel and transfer times over the -i runs, and the rate of adjacency entries traversed (undirected edges count twice, unlike Graph500 TEPS).\n");
+            fprintf(stderr, "\t--warmup <int>: untimed runs before the -i timed ones (def 0).\n");
+            fprintf(stderr, "\t--bench-out <file>: append benchmark statistics to file instead of stdout.\n");
+            fprintf(stderr, "\t--perf: report cycles, instructions, LLC/dTLB misses and per-thread unhalted time of graph construction, kernels and the cpu reference.\n");
+            fprintf(stderr, "\t--upload-chunk <int>: upload edges in chunks of value MB that kernels start on before the rest arrive; relies on implementation behaviour, 0 for one chunk (def 0).\n");
+            fprintf(stderr, "\t--reorder <none|degree|rcm|bfs>: renumber vertices by decreasing degree, reverse Cuthill-McKee or BFS order for locality; -s and results stay in input ids (def none).\n");
+            fprintf(stderr, "\t--save <file.csr>: write the built (and reordered) graph as a binary CSR with its permutation.\n");
+            fprintf(stderr, "\t--compress: delta+varint compress the adjacency lists, decoded on the fly by the mask and external engines.\n");
+            fprintf(stderr, "\t--prefetch <int>: external engine reads ahead the adjacency of value MB of frontier (def 16).\n");
+            fprintf(stderr, "\t--shard <int>: out-of-core traversal streaming only the edge shards (value MB each) of frontier vertices every level; automatic at half the largest allocation (at most 1 GB) when the edges do not fit one (def off).\n");
+            fprintf(stderr, "\t--numa: split the graph by NUMA node, move each range's pages to its node and run the mask engine per node on CPU sub-devices (best with --memory zerocopy).\n");
+            fprintf(stderr, "\t--populate: prefault the huge pages of the host graph and result arrays when they are allocated.\n");
+            fprintf(stderr, "\t--fission <int|numa>: split the CPU device into sub-devices on disjoint cores (value many or one per NUMA node) and run the -i queries, or the served batches, side by side on them.\n");
+            fprintf(stderr, "\t--devices <all|int,int,..>: devices of the partitioned engine, which splits the graph over them (def all; with --fission the sub-devices).\n");
+            fprintf(stderr, "\t--serve <socket>: keep the graph on the device and answer batched queries on a Unix socket until interrupted (protocol in Server.h).\n");
             exit(0);
         }
 
         _clCmdParams(argc, argv, &source, &iterations, &undirected);
+        arena.populate = arena_populate;
+        if (bench_format != BENCH_OFF)
+        {
+            //--kernel and transfer times without serializing the queue
+            if (profile_mode == PROFILE_OFF)
+                profile_mode = PROFILE_SUMMARY;
+            profile_quiet = true;
+        }
 
-        //Read in Graph from a file
+        //Read in Graph from a file; a binary CSR (.csr, see gengraph) is mapped
         char *input_f = argv[1];
         printf("%s\n", input_f);
-
-        FILE *fp = fopen(input_f, "r");
-        if (!fp)
+        size_t input_length = strlen(input_f);
+        bool mapped = input_length > 4 && strcmp(input_f + input_length - 4, ".csr") == 0;
+
+        traceBegin("parse");
+        perfStart("graph construction");
+        EdgeList list;
+        int *h_original = NULL; // input id of every vertex of a reordered .csr
+        if (mapped)
         {
-            printf("Error Reading graph file\n");
-            return 1;
+            mapCsr(input_f, &list.no_of_nodes, &h_nodes, &no_of_edges, &h_edges, &csr_mapping, &csr_mapping_size,
+                   &h_original);
+            list.undirected = false; // written with both directions already
         }
+        else
+            readMatrixMarket(input_f, &list);
+        list.undirected = list.undirected || undirected;
+        no_of_nodes = list.no_of_nodes;
 
-        if (mm_read_banner(fp, &matcode) != 0)
+#ifdef VERBOSE
+        printf("Amt nodes: %d\n", no_of_nodes);
+        printf("Undirected: %s\n", list.undirected ? "True" : "False");
+#endif
+        traceEnd();
+
+        traceBegin("csr build");
+        if (!mapped)
+            buildCsr(list, &h_nodes, &no_of_edges, &h_edges, &arena);
+        list.from.clear();
+        list.to.clear();
+
+        //--input vertex v is vertex new_id[v] of the traversed graph, empty if
+        //--the ids are unchanged; -s is translated here and results back below
+        std::vector<int> new_id;
+#ifndef NO_CHECK
+        //--the graph in input ids for the reference run
+        Node *input_nodes = h_original ? NULL : h_nodes;
+        int *input_edges = h_original ? NULL : h_edges;
+        int input_source = source;
+#endif
+        if (h_original)
         {
-            printf("Could not process Matrix Market banner.\n");
-            exit(1);
+            new_id.resize(no_of_nodes);
+            for (int v = 0; v < no_of_nodes; v++)
+                new_id[h_original[v]] = v;
         }
-
-        // Only supports a subset of the Matrix Market data types.
-        if (mm_is_complex(matcode) && mm_is_matrix(matcode) && 
-                mm_is_sparse(matcode) )
+        if (reorder_mode != REORDER_NONE)
         {
-            printf("Sorry, this application does not support ");
-            printf("Market Market type: [%s]\n", mm_typecode_to_str(matcode));
-            exit(1);
+            std::vector<int> step;
+            reorderVertices(no_of_nodes, h_nodes, h_edges, reorder_mode, step);
+            permuteCsr(no_of_nodes, h_nodes, no_of_edges, h_edges, step, &h_nodes, &h_edges, &arena);
+            if (new_id.empty())
+                new_id.swap(step);
+            else
+                for (int v = 0; v < no_of_nodes; v++)
+                    new_id[v] = step[new_id[v]];
         }
-
-        if(mm_is_symmetric(matcode)) {
-            undirected = true;
+        if (!save_file.empty())
+        {
+            std::vector<int> old_id(new_id.size());
+            for (size_t v = 0; v < new_id.size(); v++)
+                old_id[new_id[v]] = v;
+            writeCsr(save_file.c_str(), no_of_nodes, h_nodes, no_of_edges, h_edges, new_id.empty() ? NULL : old_id.data());
+        }
+        if (source < 0 || source >= no_of_nodes)
+            throw(string("source ") + std::to_string(source) + " is not a vertex");
+        if (!new_id.empty())
+            source = new_id[source];
+#ifdef USE_MPI
+        if (mpi_grid.ranks > 1)
+        {
+            if (!serve_socket.empty() || fission_parts >= 0 || compress_edges || engine == ENGINE_PARTITIONED)
+                throw(string("--serve, --fission, --compress and -e partitioned run in one process, not under mpirun"));
+            mpiDistribute(no_of_nodes, h_nodes, h_edges);
         }
+#endif
 
-        // find out size of sparse matrix ....
-        int N, nz;   
-        if (mm_read_mtx_crd_size(fp, &no_of_nodes, &N, &nz) != 0)
-            exit(1);
+        // Distribute threads across multiple Blocks if necessary
+        if (work_group_size == 0)
+            work_group_size = no_of_nodes > MAX_THREADS_PER_BLOCK ? MAX_THREADS_PER_BLOCK : no_of_nodes;
 
-        if(no_of_nodes != N) {
-            printf("[WARNING] Not sure if non-square matrices work properly...");
+        // Allocate host memory
+        h_mask = arenaAlloc<char>(&arena, no_of_nodes);
+        h_new_mask = arenaAlloc<char>(&arena, no_of_nodes);
+        h_visited = arenaAlloc<char>(&arena, no_of_nodes);
+
+        //--the mask and external engines can traverse compressed lists instead
+        Node *run_nodes = h_nodes;
+        int run_no_of_edges = no_of_edges;
+        int *run_edges = h_edges;
+        if (compress_edges)
+        {
+            if ((engine != ENGINE_MASK && engine != ENGINE_EXTERNAL) || fission_parts >= 0 || !serve_socket.empty())
+                throw(string("--compress works with -e mask or external, without --fission or --serve"));
+            unsigned char *bytes;
+            compressCsr(no_of_nodes, h_nodes, h_edges, &run_nodes, &run_no_of_edges, &bytes, &arena);
+            run_edges = (int *)bytes;
+            printf("Compressed: %d edges in %lld bytes (%0.2f bytes per edge)\n", no_of_edges, (long long)run_no_of_edges * 4,
+                   run_no_of_edges * 4.0 / std::max(no_of_edges, 1));
         }
 
-        /* reserve memory for matrices */
-        val = (double *) malloc(nz * sizeof(double));
+        perfStop("graph construction");
+        traceEnd();
 
-        /* NOTE: when reading in doubles, ANSI C requires the use of the "l"  */
-        /*   specifier as in "%lg", "%lf", "%le", otherwise errors will occur */
-        /*  (ANSI C X3.159-1989, Sec. 4.9.6.2, p. 136 lines 13-15)            */
+        if (numa_mode)
+        {
+            traceBegin("numa placement");
+            numaDiscover();
+            splitByEdges(no_of_nodes, h_nodes, no_of_edges, numa_nodes.size(), numa_bounds);
+            std::vector<NumaArray> arrays = {{(char *)h_nodes, sizeof(Node), false}, {(char *)h_edges, sizeof(int), true},
+                                             {h_mask, 1, false}, {h_new_mask, 1, false}, {h_visited, 1, false}};
+            bool bound = numaPlace(h_nodes, arrays);
+            printf("NUMA: %d nodes, graph %s\n", (int)numa_nodes.size(), bound ? "bound with mbind" : "copied by pinned threads");
+            traceEnd();
+        }
 
-#ifdef VERBOSE
-        printf("Amt nodes: %d\n", no_of_nodes);
-        printf("Undirected: %s\n", undirected ? "True" : "False");
+        //--the semi-external engine runs on the host alone and needs no OpenCL
+        //--platform, unless mpirun spreads it over ranks
+        if (engine == ENGINE_EXTERNAL && (fission_parts >= 0 || !serve_socket.empty()))
+            throw(string("-e external runs on the host; not with --fission or --serve"));
+        bool host_only = engine == ENGINE_EXTERNAL;
+#ifdef USE_MPI
+        host_only = host_only && mpi_grid.ranks <= 1;
 #endif
-        std::unordered_set<int>* construction_set = new std::unordered_set<int>[no_of_nodes];
 
-        if(mm_is_pattern(matcode))
+        traceBegin("opencl init");
+        if (!host_only)
+            _clInit();
+        //--edges past the device's largest allocation are streamed in shards
+        //--by the out-of-core engine, which stands in for the selected one;
+        //--fission and serving keep the whole edge array on every device
+        bool oversized = !host_only && (cl_ulong)no_of_edges * sizeof(int) > cl_env->max_alloc_size;
+        if (shard_bytes > 0 && (engine != ENGINE_MASK || compress_edges || fission_parts >= 0 || !serve_socket.empty()))
+            throw(string("--shard replaces the mask engine; not with another -e, --compress, --fission or --serve"));
+        if (oversized && ((fission_parts >= 0 && engine != ENGINE_PARTITIONED) || !serve_socket.empty()))
+            throw(string("the edge array exceeds the device's largest allocation; --fission and --serve need it whole"));
+        std::vector<CLEnvironment> fission_envs;
+        if (fission_parts >= 0)
         {
-           for (int i = 0; i < nz; i++)
-            {
-                int x, y;
-                if(fscanf(fp, "%d %d\n", &x, &y) != 2) {
-                    printf("Failed to read line %d\n", i);
-                }
-                x--;  /* adjust from 1-based to 0-based */
-                y--;
-
-                construction_set[x].insert(y);
-                if(undirected) {
-                    construction_set[y].insert(x);
-                }
-            }
+            if (!cpu)
+                throw(string("--fission needs a CPU device (-c)"));
+            fission_envs = _clSplit(fission_parts);
+            printf("Fission: %d sub-devices\n", (int)fission_envs.size());
         }
-        else
+        //--the partitioned engine takes the sub-devices, or one environment
+        //--per selected device
+        std::vector<CLEnvironment> partition_envs;
+        if (engine == ENGINE_PARTITIONED && serve_socket.empty())
         {
-            for (int i = 0; i < nz; i++)
+            if (!fission_envs.empty())
+                partition_envs.swap(fission_envs);
+            else
             {
-                int x, y;
-                if(fscanf(fp, "%d %d %lg\n", &x, &y, &val[i]) != 3) {
-                    printf("Failed to read line %d\n", i);
-                }
-                x--;  /* adjust from 1-based to 0-based */
-                y--;
-
-                construction_set[x].insert(y);
-                if(undirected) {
-                    construction_set[y].insert(x);
+                std::vector<int> ids = partition_devices;
+                for (int id = 0; ids.empty() && id < (int)default_env.devices.size(); id++)
+                    ids.push_back(id);
+                partition_envs.resize(ids.size());
+                for (size_t i = 0; i < ids.size(); i++)
+                {
+                    if (ids[i] < 0 || ids[i] >= (int)default_env.devices.size())
+                        throw(string("--devices: no device ") + std::to_string(ids[i]));
+                    CLBinding binding(partition_envs[i]);
+                    _clInit(cpu, ids[i]);
                 }
             }
+            printf("Partitioned: %d devices\n", (int)partition_envs.size());
         }
-        
-        if (fp !=stdin) fclose(fp);
-
-        int no_of_edges = nz * 2;
-        h_edges = (int*) malloc(sizeof(int) * no_of_edges);
+        traceEnd();
 
-        // Distribute threads across multiple Blocks if necessary
-        work_group_size = no_of_nodes > MAX_THREADS_PER_BLOCK ? MAX_THREADS_PER_BLOCK : no_of_nodes;
+        if (!serve_socket.empty())
+        {
+            profile_quiet = true;
+            serve(serve_socket.c_str(), no_of_nodes, h_nodes, no_of_edges, h_edges, fission_envs, new_id);
+            _clReleaseAll(fission_envs);
+            _clRelease();
+            if (tracing)
+                writeTrace(trace_file);
+            perfReport();
+            arenaRelease(&arena);
+            if (csr_mapping)
+                munmap(csr_mapping, csr_mapping_size);
+#ifdef USE_MPI
+            mpiFinalize();
+#endif
+            return 0;
+        }
 
-        // Allocate host memory
-        h_nodes = (Node *)malloc(sizeof(Node) * no_of_nodes);
-        h_mask = (char *)malloc(sizeof(char) * no_of_nodes);
-        h_new_mask = (char *)malloc(sizeof(char) * no_of_nodes);
-        h_visited = (char *)malloc(sizeof(char) * no_of_nodes);
+        // Allocate mem for the result on host side and run bfs
+        int **h_cost = arenaAlloc<int *>(&arena, iterations);
+        for(int i = 0; i < iterations; i++)
+            h_cost[i] = arenaAlloc<int>(&arena, no_of_nodes);
+        if (numa_mode)
+        {
+            std::vector<NumaArray> arrays;
+            for (int i = 0; i < iterations; i++)
+                arrays.push_back(NumaArray{(char *)h_cost[i], sizeof(int), false});
+            numaPlace(h_nodes, arrays);
+            if (cpu && !host_only && numaParts() == 0)
+                printf("NUMA: device not split by node, kernels run on the whole device\n");
+        }
 
-        int index = 0;
-        for (int i = 0; i < no_of_nodes; i++)
+        if (!fission_envs.empty())
         {
-            h_nodes[i].starting = index;
-            h_nodes[i].no_of_edges = construction_set[i].size();
-            std::copy(construction_set[i].begin(), construction_set[i].end(), &h_edges[index]);
-            index += construction_set[i].size();
-            construction_set[i].clear();
+            //--the -i queries side by side, after warmup queries of their own
+            if (bench_warmup > 0)
+            {
+                std::vector<int *> warm_cost(bench_warmup);
+                std::vector<int> warm_sources(bench_warmup, source);
+                for (int i = 0; i < bench_warmup; i++)
+                {
+                    warm_cost[i] = arenaAlloc<int>(&arena, no_of_nodes);
+                    for (int j = 0; j < no_of_nodes; j++)
+                        warm_cost[i][j] = -1;
+                }
+                run_bfs_concurrent(fission_envs, engine, bench_warmup, warm_sources.data(), no_of_nodes, h_nodes, no_of_edges, h_edges, warm_cost.data(), NULL);
+            }
 
-            h_mask[i] = false;
-            h_new_mask[i] = false;
-            h_visited[i] = false;   
+            for (int i = 0; i < iterations; i++)
+                for (int j = 0; j < no_of_nodes; j++)
+                    h_cost[i][j] = -1;
+            std::vector<int> sources(iterations, source);
+            std::vector<QueryTimes> times(iterations);
+
+            traceBegin("bfs");
+            unsigned long long start = benchNow();
+            run_bfs_concurrent(fission_envs, engine, iterations, sources.data(), no_of_nodes, h_nodes, no_of_edges, h_edges, h_cost, times.data());
+            unsigned long long end = benchNow();
+            traceEnd();
+            printf("Fission: %d queries in %0.3f ms (%0.1f queries/s)\n", iterations, (end - start) / 1000000.0,
+                   iterations * 1e9 / std::max(end - start, 1ULL));
+
+            for (int i = 0; i < iterations && bench_format != BENCH_OFF; i++)
+            {
+                BenchRun run;
+                run.e2e_ms = times[i].e2e_ns / 1000000.0;
+                run.kernel_ms = times[i].timers[PROFILE_KERNEL] / 1000000.0;
+                run.transfer_ms = (times[i].timers[PROFILE_H2D] + times[i].timers[PROFILE_D2H]) / 1000000.0;
+                run.edges = 0;
+                for (int j = 0; j < no_of_nodes; j++)
+                    if (h_cost[i][j] >= 0)
+                        run.edges += h_nodes[j].no_of_edges;
+                bench_runs.push_back(run);
+            }
         }
 
-        _clInit();
+        bool out_of_core = engine != ENGINE_PARTITIONED && engine != ENGINE_EXTERNAL && !compress_edges &&
+                           (shard_bytes > 0 || oversized);
+        if (out_of_core && fission_envs.empty())
+            printf("Out-of-core: edges streamed in shards of %llu MB%s\n",
+                   (unsigned long long)outOfCoreShardBytes() >> 20,
+                   engine != ENGINE_MASK ? ", in place of the selected engine" : "");
 
-        // Allocate mem for the result on host side and run bfs
-        int **h_cost;
-        h_cost = (int**) malloc(iterations * sizeof(int*));    
-        for(int i = 0; i < iterations; i++)
+        //--warmup runs (i < 0) reuse the first result array and are not timed;
+        //--with --fission the queries ran above
+        for(int i = -bench_warmup; i < iterations && fission_envs.empty(); i++)
         {    
-            h_cost[i] = (int*) malloc(no_of_nodes * sizeof(int));
+            int *cost = h_cost[i < 0 ? 0 : i];
             for (int j = 0; j < no_of_nodes; j++)
             {
-                h_cost[i][j] = -1;
+                cost[j] = -1;
+                // zero-copy runs update the masks in place
+                h_mask[j] = false;
+                h_new_mask[j] = false;
+                h_visited[j] = false;
             }
 
     #ifdef VERBOSE
@@ -415,20 +354,76 @@ int main(int argc, char *argv[])
 
             //---------------------------------------------------------
             //--opencl entry
-            h_cost[i][source] = 0;
+            traceBegin("bfs");
+            unsigned long long start = benchNow();
+            cost[source] = 0;
             h_mask[source] = true;
             h_visited[source] = true;
-            run_bfs_opencl(no_of_nodes, h_nodes, no_of_edges, h_edges, h_mask, h_new_mask, h_visited, h_cost[i]);
+#ifdef USE_MPI
+            if (mpi_grid.ranks > 1)
+                run_bfs_distributed(no_of_nodes, cost, source);
+            else
+#endif
+            if (engine == ENGINE_EXTERNAL)
+                run_bfs_semi_external(no_of_nodes, run_nodes, run_no_of_edges, run_edges, cost, source, compress_edges);
+            else if (out_of_core)
+                run_bfs_out_of_core(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+            else if (engine == ENGINE_QUEUE)
+                run_bfs_opencl_queue(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+            else if (engine == ENGINE_ADAPTIVE)
+                run_bfs_opencl_adaptive(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+            else if (engine == ENGINE_HYBRID)
+                run_bfs_hybrid(no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+            else if (engine == ENGINE_PARTITIONED)
+                run_bfs_partitioned(partition_envs, no_of_nodes, h_nodes, no_of_edges, h_edges, cost, source);
+            else
+                run_bfs_opencl(no_of_nodes, run_nodes, run_no_of_edges, run_edges, h_mask, h_new_mask, h_visited, cost, compress_edges);
+            unsigned long long end = benchNow();
+            traceEnd();
+
+            if (bench_format != BENCH_OFF && i >= 0)
+            {
+                BenchRun run;
+                run.e2e_ms = (end - start) / 1000000.0;
+                run.kernel_ms = last_run_timers[PROFILE_KERNEL] / 1000000.0;
+                run.transfer_ms = (last_run_timers[PROFILE_H2D] + last_run_timers[PROFILE_D2H]) / 1000000.0;
+                run.edges = 0;
+                for (int j = 0; j < no_of_nodes; j++)
+                    if (cost[j] >= 0)
+                        run.edges += h_nodes[j].no_of_edges;
+                bench_runs.push_back(run);
+            }
         }
-
-        _clRelease();
+        if (bench_format != BENCH_OFF)
+            writeBench(input_f, no_of_nodes);
+        for (int i = 0; i < iterations && !new_id.empty(); i++)
+            unpermute(no_of_nodes, new_id.data(), h_cost[i]);
+
+        if (profile_mode != PROFILE_OFF && !profile_quiet && !host_only)
+            _clPoolReport();
+        _clReleaseAll(partition_envs);
+        _clReleaseAll(fission_envs);
+        if (!host_only)
+            _clRelease();
 
 #ifndef NO_CHECK
         //---------------------------------------------------------
         //--cpu entry
         // Initialize the memory again
+        traceBegin("verify");
 
-        int *h_cost_ref = (int *)malloc(sizeof(int) * no_of_nodes);
+        int *h_cost_ref = arenaAlloc<int>(&arena, no_of_nodes);
+
+        //--the reference traverses the graph in input ids from the untranslated
+        //--source, so a wrong renumbering shows up as a mismatch. A reordered
+        //--.csr has no input-order copy; rename it back to make one.
+        if (!input_nodes)
+        {
+            std::vector<int> old_id(no_of_nodes);
+            for (int v = 0; v < no_of_nodes; v++)
+                old_id[new_id[v]] = v;
+            permuteCsr(no_of_nodes, h_nodes, no_of_edges, h_edges, old_id, &input_nodes, &input_edges, &arena);
+        }
 
         for (int i = 0; i < no_of_nodes; i++)
         {
@@ -442,34 +437,40 @@ int main(int argc, char *argv[])
         printf("Running cpu...\n");
 #endif
         // Set the source node as true in the mask4
-        h_cost_ref[source] = 0;
-        h_mask[source] = true;
-        h_visited[source] = true;
-        run_bfs_cpu(no_of_nodes, h_nodes, no_of_edges, h_edges, h_mask, h_new_mask, h_visited, h_cost_ref);
+        h_cost_ref[input_source] = 0;
+        h_mask[input_source] = true;
+        h_visited[input_source] = true;
+        perfStart("cpu reference");
+        run_bfs_cpu(no_of_nodes, input_nodes, no_of_edges, input_edges, h_mask, h_new_mask, h_visited, h_cost_ref);
+        perfStop("cpu reference");
         //---------------------------------------------------------
         //--result verification
-        for(int i = 0; i < iterations; i++) {
+        for(int i = 0; i < iterations; i++)
             compare_results<int>(h_cost_ref, h_cost[i], no_of_nodes);
-            free(h_cost[i]);
-        }
-        free(h_cost);
+        traceEnd();
 #endif
+
+        if (tracing)
+            writeTrace(trace_file);
+        perfReport();
     }
     catch (std::string msg)
     {
         std::cout << "--cambine: exception in main ->" << msg << std::endl;
+#ifdef USE_MPI
+        //--the other ranks would wait in the next collective forever
+        if (mpi_grid.ranks > 1)
+            MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
     }
 
     // Release host memory
-    free(I);
-    free(J);
-    free(val);
-    free(h_nodes);
-    
-    free(h_mask);
-    free(h_new_mask);
-    free(h_visited);
-    free(h_edges);
+    arenaRelease(&arena);
+    if (csr_mapping)
+        munmap(csr_mapping, csr_mapping_size);
+#ifdef USE_MPI
+    mpiFinalize();
+#endif
 
     return 0;
 }
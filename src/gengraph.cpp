@@ -0,0 +1,62 @@
+//----------------------------------------------------------
+//--synthetic graphs for the benchmark suite (see generateGraph in Graph.h),
+//--written as symmetric pattern Matrix Market files, or as binary CSR files
+//--for mapping (Graph::mmap in libbfs) when the output name ends in .csr
+//----------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Graph.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s <kron|grid|random> <a> <b> <output_file> [seed]\n", argv[0]);
+        fprintf(stderr, "\tkron <scale> <edgefactor>: 2^scale vertices, edgefactor * 2^scale edges.\n");
+        fprintf(stderr, "\tgrid <width> <height>: width * height lattice.\n");
+        fprintf(stderr, "\trandom <nodes> <edges>: uniform random edges.\n");
+        exit(0);
+    }
+
+    long long a = atoll(argv[2]);
+    long long b = atoll(argv[3]);
+    unsigned long long seed = argc > 5 ? strtoull(argv[5], NULL, 10) : 1;
+    std::string output = argv[4];
+
+    try
+    {
+        EdgeList list;
+        generateGraph(argv[1], a, b, seed, &list);
+
+        if (output.size() > 4 && output.compare(output.size() - 4, 4, ".csr") == 0)
+        {
+            Node *h_nodes;
+            int *h_edges;
+            int no_of_edges;
+            buildCsr(list, &h_nodes, &no_of_edges, &h_edges);
+            writeCsr(output.c_str(), list.no_of_nodes, h_nodes, no_of_edges, h_edges);
+            free(h_nodes);
+            free(h_edges);
+            return 0;
+        }
+
+        FILE *fp = fopen(output.c_str(), "w");
+        if (!fp)
+            throw(std::string("Could not open ") + output);
+        fprintf(fp, "%%%%MatrixMarket matrix coordinate pattern symmetric\n");
+        fprintf(fp, "%d %d %lu\n", list.no_of_nodes, list.no_of_nodes, list.from.size());
+        for (size_t e = 0; e < list.from.size(); e++)
+            fprintf(fp, "%d %d\n", list.from[e] + 1, list.to[e] + 1);
+        fclose(fp);
+    }
+    catch (std::string msg)
+    {
+        fprintf(stderr, "%s\n", msg.c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+//------------------------------------------
+//--libbfs: library front end over Graph.h and the engines in Engines.h
+//------------------------------------------
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <sys/mman.h>
+
+#include "Engines.h"
+#include "Bench.h"
+#include "libbfs.h"
+
+static_assert(sizeof(bfs::Node) == sizeof(::Node), "bfs::Node must match the engines' Node");
+
+namespace bfs
+{
+
+//----------------------------------------------------------
+//--Graph
+//----------------------------------------------------------
+Graph::Graph() : no_of_nodes(0), no_of_edges(0), h_nodes(NULL), h_edges(NULL), mapping(NULL), mapping_size(0) {}
+
+Graph::Graph(Graph &&other) noexcept : Graph()
+{
+    *this = std::move(other);
+}
+
+Graph &Graph::operator=(Graph &&other) noexcept
+{
+    if (this != &other)
+    {
+        clear();
+        no_of_nodes = other.no_of_nodes;
+        no_of_edges = other.no_of_edges;
+        h_nodes = other.h_nodes;
+        h_edges = other.h_edges;
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        new_id.swap(other.new_id);
+        other.h_nodes = NULL;
+        other.h_edges = NULL;
+        other.mapping = NULL;
+        other.clear();
+    }
+    return *this;
+}
+
+Graph::~Graph()
+{
+    clear();
+}
+
+void Graph::clear()
+{
+    if (mapping)
+        munmap(mapping, mapping_size);
+    else
+    {
+        free(h_nodes);
+        free(h_edges);
+    }
+    no_of_nodes = no_of_edges = 0;
+    h_nodes = NULL;
+    h_edges = NULL;
+    mapping = NULL;
+    mapping_size = 0;
+    new_id.clear();
+}
+
+static void fromEdgeList(const EdgeList &list, int *no_of_nodes, Node **h_nodes, int *no_of_edges, int **h_edges)
+{
+    ::Node *nodes;
+    buildCsr(list, &nodes, no_of_edges, h_edges);
+    *h_nodes = (Node *)nodes;
+    *no_of_nodes = list.no_of_nodes;
+}
+
+Graph Graph::load(const std::string &path, bool undirected)
+{
+    EdgeList list;
+    readMatrixMarket(path.c_str(), &list);
+    list.undirected = list.undirected || undirected;
+
+    Graph graph;
+    fromEdgeList(list, &graph.no_of_nodes, &graph.h_nodes, &graph.no_of_edges, &graph.h_edges);
+    return graph;
+}
+
+Graph Graph::generate(const std::string &type, long long a, long long b, unsigned long long seed)
+{
+    EdgeList list;
+    generateGraph(type, a, b, seed, &list);
+
+    Graph graph;
+    fromEdgeList(list, &graph.no_of_nodes, &graph.h_nodes, &graph.no_of_edges, &graph.h_edges);
+    return graph;
+}
+
+Graph Graph::mmap(const std::string &path)
+{
+    Graph graph;
+    ::Node *nodes;
+    int *h_original;
+    mapCsr(path.c_str(), &graph.no_of_nodes, &nodes, &graph.no_of_edges, &graph.h_edges, &graph.mapping, &graph.mapping_size,
+           &h_original);
+    graph.h_nodes = (Node *)nodes;
+    if (h_original)
+    {
+        graph.new_id.resize(graph.no_of_nodes);
+        for (int v = 0; v < graph.no_of_nodes; v++)
+            graph.new_id[h_original[v]] = v;
+    }
+    return graph;
+}
+
+void Graph::save(const std::string &path) const
+{
+    std::vector<int> old_id(new_id.size());
+    for (size_t v = 0; v < new_id.size(); v++)
+        old_id[new_id[v]] = v;
+    writeCsr(path.c_str(), no_of_nodes, (const ::Node *)h_nodes, no_of_edges, h_edges, new_id.empty() ? NULL : old_id.data());
+}
+
+void Graph::reorder(ReorderType how)
+{
+    ::ReorderMode mode = how == REORDER_DEGREE ? ::REORDER_DEGREE : how == REORDER_RCM ? ::REORDER_RCM : ::REORDER_BFS;
+    std::vector<int> step;
+    reorderVertices(no_of_nodes, (const ::Node *)h_nodes, h_edges, mode, step);
+    ::Node *nodes;
+    int *edges;
+    permuteCsr(no_of_nodes, (const ::Node *)h_nodes, no_of_edges, h_edges, step, &nodes, &edges);
+
+    //--the permuted copy replaces the arrays, or the file mapping
+    std::vector<int> composed;
+    if (new_id.empty())
+        composed.swap(step);
+    else
+        for (int v = 0; v < no_of_nodes; v++)
+            composed.push_back(step[new_id[v]]);
+    int nodes_count = no_of_nodes, edges_count = no_of_edges;
+    clear();
+    no_of_nodes = nodes_count;
+    no_of_edges = edges_count;
+    h_nodes = (Node *)nodes;
+    h_edges = edges;
+    new_id.swap(composed);
+}
+
+//----------------------------------------------------------
+//--BfsResult
+//----------------------------------------------------------
+BfsResult::BfsResult() : no_of_nodes(0), h_levels(NULL), h_parents(NULL)
+{
+    memset(&run_stats, 0, sizeof(run_stats));
+}
+
+BfsResult::BfsResult(BfsResult &&other) noexcept : BfsResult()
+{
+    *this = std::move(other);
+}
+
+BfsResult &BfsResult::operator=(BfsResult &&other) noexcept
+{
+    if (this != &other)
+    {
+        free(h_levels);
+        free(h_parents);
+        no_of_nodes = other.no_of_nodes;
+        h_levels = other.h_levels;
+        h_parents = other.h_parents;
+        run_stats = other.run_stats;
+        other.h_levels = NULL;
+        other.h_parents = NULL;
+    }
+    return *this;
+}
+
+BfsResult::~BfsResult()
+{
+    free(h_levels);
+    free(h_parents);
+}
+
+int *BfsResult::releaseLevels()
+{
+    int *levels = h_levels;
+    h_levels = NULL;
+    return levels;
+}
+
+//----------------------------------------------------------
+//--BfsEngine
+//----------------------------------------------------------
+struct BfsEngine::Impl
+{
+    BfsOptions options;
+    CLEnvironment env; // unused by ENGINE_CPU
+};
+
+BfsEngine::BfsEngine(const BfsOptions &options) : impl(new Impl)
+{
+    impl->options = options;
+    if (options.engine == ENGINE_CPU)
+        return;
+
+    ::MemoryMode memory = options.memory == MEMORY_ZEROCOPY ? ::MEMORY_ZEROCOPY
+                        : options.memory == MEMORY_AUTO     ? ::MEMORY_AUTO
+                                                            : ::MEMORY_COPY;
+    ProfileMode previous = profile_mode;
+    profile_mode = options.profile ? PROFILE_SUMMARY : PROFILE_OFF;
+    try
+    {
+        CLBinding binding(impl->env);
+        _clInit(options.cpu, options.device_id, memory);
+    }
+    catch (std::string msg)
+    {
+        profile_mode = previous;
+        throw("in BfsEngine -> " + msg);
+    }
+    profile_mode = previous;
+}
+
+BfsEngine::BfsEngine(std::unique_ptr<Impl> impl) : impl(std::move(impl)) {}
+
+std::vector<BfsEngine> BfsEngine::split(const BfsOptions &options, int parts)
+{
+    if (options.engine == ENGINE_CPU || !options.cpu)
+        throw(std::string("BfsEngine::split()::Error: fission needs an OpenCL CPU device"));
+
+    ::MemoryMode memory = options.memory == MEMORY_ZEROCOPY ? ::MEMORY_ZEROCOPY
+                        : options.memory == MEMORY_AUTO     ? ::MEMORY_AUTO
+                                                            : ::MEMORY_COPY;
+    ProfileMode previous = profile_mode;
+    profile_mode = options.profile ? PROFILE_SUMMARY : PROFILE_OFF;
+    std::vector<CLEnvironment> envs;
+    try
+    {
+        //--the whole device only long enough to split it
+        CLEnvironment parent;
+        CLBinding binding(parent);
+        _clInit(options.cpu, options.device_id, memory);
+        envs = _clSplit(parts, memory);
+    }
+    catch (std::string msg)
+    {
+        profile_mode = previous;
+        throw("in BfsEngine::split -> " + msg);
+    }
+    profile_mode = previous;
+
+    std::vector<BfsEngine> engines;
+    for (size_t i = 0; i < envs.size(); i++)
+    {
+        std::unique_ptr<Impl> impl(new Impl);
+        impl->options = options;
+        impl->env = std::move(envs[i]);
+        engines.push_back(BfsEngine(std::move(impl)));
+    }
+    return engines;
+}
+
+BfsEngine::BfsEngine(BfsEngine &&other) noexcept = default;
+BfsEngine &BfsEngine::operator=(BfsEngine &&other) noexcept = default;
+BfsEngine::~BfsEngine() = default;
+
+BfsResult BfsEngine::run(const Graph &graph, int source)
+{
+    const BfsOptions &options = impl->options;
+    int no_of_nodes = graph.nodes();
+    int no_of_edges = graph.edges();
+    if (source < 0 || source >= no_of_nodes)
+        throw(std::string("BfsEngine::run()::Error: source out of range"));
+    //--a reordered graph is traversed in its own ids
+    const int *new_id = graph.permutation();
+    if (new_id)
+        source = new_id[source];
+
+    //--the engines take mutable pointers; they only write the cost array
+    ::Node *h_nodes = (::Node *)graph.offsets();
+    int *h_edges = (int *)graph.adjacency();
+
+    BfsResult result;
+    result.no_of_nodes = no_of_nodes;
+    result.h_levels = malloc_aligned<int>(no_of_nodes);
+    for (int i = 0; i < no_of_nodes; i++)
+        result.h_levels[i] = -1;
+    result.h_levels[source] = 0;
+
+    //--per-thread settings the engines read
+    size_t previous_work_group_size = work_group_size;
+    ProfileMode previous_profile_mode = profile_mode;
+    bool previous_quiet = profile_quiet;
+    work_group_size = options.work_group_size ? options.work_group_size : std::min(no_of_nodes, 256);
+    profile_mode = options.profile ? PROFILE_SUMMARY : PROFILE_OFF;
+    profile_quiet = true;
+    for (int i = 0; i < 3; i++)
+        last_run_timers[i] = 0;
+
+    char *h_mask = NULL, *h_new_mask = NULL, *h_visited = NULL;
+    unsigned long long start = benchNow();
+    try
+    {
+        if (options.engine == ENGINE_CPU || options.engine == ENGINE_MASK)
+        {
+            h_mask = malloc_aligned<char>(no_of_nodes);
+            h_new_mask = malloc_aligned<char>(no_of_nodes);
+            h_visited = malloc_aligned<char>(no_of_nodes);
+            memset(h_mask, 0, no_of_nodes);
+            memset(h_new_mask, 0, no_of_nodes);
+            memset(h_visited, 0, no_of_nodes);
+            h_mask[source] = true;
+            h_visited[source] = true;
+        }
+
+        if (options.engine == ENGINE_CPU)
+            run_bfs_cpu(no_of_nodes, h_nodes, no_of_edges, h_edges, h_mask, h_new_mask, h_visited, result.h_levels);
+        else
+        {
+            CLBinding binding(impl->env);
+            if (options.engine == ENGINE_QUEUE)
+                run_bfs_opencl_queue(no_of_nodes, h_nodes, no_of_edges, h_edges, result.h_levels, source);
+            else if (options.engine == ENGINE_ADAPTIVE)
+                run_bfs_opencl_adaptive(no_of_nodes, h_nodes, no_of_edges, h_edges, result.h_levels, source);
+            else if (options.engine == ENGINE_HYBRID)
+                run_bfs_hybrid(no_of_nodes, h_nodes, no_of_edges, h_edges, result.h_levels, source);
+            else
+                run_bfs_opencl(no_of_nodes, h_nodes, no_of_edges, h_edges, h_mask, h_new_mask, h_visited, result.h_levels);
+        }
+    }
+    catch (std::string msg)
+    {
+        free(h_mask);
+        free(h_new_mask);
+        free(h_visited);
+        work_group_size = previous_work_group_size;
+        profile_mode = previous_profile_mode;
+        profile_quiet = previous_quiet;
+        throw("in BfsEngine::run -> " + msg);
+    }
+    unsigned long long end = benchNow();
+
+    free(h_mask);
+    free(h_new_mask);
+    free(h_visited);
+    work_group_size = previous_work_group_size;
+    profile_mode = previous_profile_mode;
+    profile_quiet = previous_quiet;
+
+    BfsStats &stats = result.run_stats;
+    stats.elapsed_ms = (end - start) / 1000000.0;
+    stats.h2d_ms = last_run_timers[PROFILE_H2D] / 1000000.0;
+    stats.kernel_ms = last_run_timers[PROFILE_KERNEL] / 1000000.0;
+    stats.d2h_ms = last_run_timers[PROFILE_D2H] / 1000000.0;
+    for (int v = 0; v < no_of_nodes; v++)
+    {
+        if (result.h_levels[v] < 0)
+            continue;
+        stats.reached++;
+        stats.edges_traversed += h_nodes[v].no_of_edges;
+        stats.depth = std::max(stats.depth, result.h_levels[v] + 1);
+    }
+
+    if (options.parents)
+    {
+        result.h_parents = malloc_aligned<int>(no_of_nodes);
+        bfsParents(no_of_nodes, h_nodes, h_edges, result.h_levels, source, result.h_parents);
+    }
+
+    if (new_id)
+    {
+        std::vector<int> old_id(no_of_nodes);
+        for (int v = 0; v < no_of_nodes; v++)
+            old_id[new_id[v]] = v;
+        unpermute(no_of_nodes, new_id, result.h_levels);
+        if (result.h_parents)
+            unpermute(no_of_nodes, new_id, result.h_parents, old_id.data());
+    }
+
+    return result;
+}
+
+} // namespace bfs
@@ -0,0 +1,177 @@
+//------------------------------------------
+//--libbfs: in-process breadth first search on OpenCL devices.
+//--
+//--  bfs::Graph graph = bfs::Graph::load("road_usa.mtx");
+//--  bfs::BfsOptions options;
+//--  options.engine = bfs::ENGINE_QUEUE;
+//--  bfs::BfsEngine engine(options);      // builds the OpenCL program once
+//--  bfs::BfsResult result = engine.run(graph, 0);
+//--  const int *levels = result.levels(); // no copy
+//--
+//--Errors are thrown as std::string. A BfsEngine owns its own OpenCL
+//--context, so engines can be used from different threads at the same time;
+//--a single engine must not run two queries at once.
+//------------------------------------------
+#ifndef _LIBBFS_
+#define _LIBBFS_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bfs
+{
+
+// Adjacency list of one vertex in the CSR arrays
+struct Node
+{
+    int starting;
+    int no_of_edges;
+};
+
+// Vertex renumbering for locality, see Graph::reorder
+enum ReorderType
+{
+    REORDER_DEGREE, // decreasing degree
+    REORDER_RCM,    // reverse Cuthill-McKee
+    REORDER_BFS     // breadth first from the largest-degree vertex of each component
+};
+
+class Graph
+{
+public:
+    //--Matrix Market coordinate file; symmetric files are undirected
+    static Graph load(const std::string &path, bool undirected = false);
+    //--synthetic graph: "kron" <scale> <edgefactor>, "grid" <width> <height>
+    //--or "random" <nodes> <edges>
+    static Graph generate(const std::string &type, long long a, long long b, unsigned long long seed = 1);
+    //--binary CSR file written by save(), mapped instead of read
+    static Graph mmap(const std::string &path);
+
+    //--file for mmap(), with the permutation if the graph was reordered
+    void save(const std::string &path) const;
+
+    //--renumber the vertices so that vertices visited together sit together.
+    //--BfsEngine::run still takes and returns input vertex ids; offsets()
+    //--and adjacency() are in the new ids.
+    void reorder(ReorderType how);
+    //--new id of every input vertex, NULL if never reordered
+    const int *permutation() const { return new_id.empty() ? NULL : new_id.data(); }
+
+    Graph(Graph &&other) noexcept;
+    Graph &operator=(Graph &&other) noexcept;
+    Graph(const Graph &) = delete;
+    Graph &operator=(const Graph &) = delete;
+    ~Graph();
+
+    int nodes() const { return no_of_nodes; }
+    int edges() const { return no_of_edges; }
+    const Node *offsets() const { return h_nodes; }
+    const int *adjacency() const { return h_edges; }
+
+private:
+    Graph();
+    void clear();
+
+    int no_of_nodes;
+    int no_of_edges;
+    Node *h_nodes;
+    int *h_edges;
+    void *mapping; // non-NULL if h_nodes/h_edges point into a file mapping
+    size_t mapping_size;
+    std::vector<int> new_id;
+};
+
+enum EngineType
+{
+    ENGINE_MASK,     // BFS_1 over char masks
+    ENGINE_QUEUE,    // compact frontier queue
+    ENGINE_ADAPTIVE, // queue or bitmap, chosen per level
+    ENGINE_CPU,      // sequential reference on the host, no OpenCL
+    ENGINE_HYBRID    // small levels on the host, large ones on the device
+};
+
+enum MemoryType
+{
+    MEMORY_COPY,
+    MEMORY_ZEROCOPY,
+    MEMORY_AUTO
+};
+
+struct BfsOptions
+{
+    EngineType engine = ENGINE_MASK;
+    bool cpu = false;           // OpenCL CPU device instead of the GPU
+    int device_id = 0;
+    MemoryType memory = MEMORY_COPY;
+    size_t work_group_size = 0; // 0: min(nodes, 256)
+    bool parents = false;       // also compute a BFS tree
+    bool profile = false;       // device times in BfsStats (non-blocking)
+};
+
+struct BfsStats
+{
+    int depth;                  // number of levels
+    int reached;                // vertices with a level
+    long long edges_traversed;  // out-degree sum of reached vertices
+    double elapsed_ms;          // host time of the traversal
+    double h2d_ms, kernel_ms, d2h_ms; // device times, 0 unless options.profile
+};
+
+class BfsResult
+{
+public:
+    BfsResult(BfsResult &&other) noexcept;
+    BfsResult &operator=(BfsResult &&other) noexcept;
+    BfsResult(const BfsResult &) = delete;
+    BfsResult &operator=(const BfsResult &) = delete;
+    ~BfsResult();
+
+    int nodes() const { return no_of_nodes; }
+    //--level of every vertex, -1 if unreachable from the source
+    const int *levels() const { return h_levels; }
+    //--parent of every vertex in a BFS tree, the source is its own parent,
+    //---1 if unreachable; NULL unless options.parents was set
+    const int *parents() const { return h_parents; }
+    const BfsStats &stats() const { return run_stats; }
+
+    //--take over the level array (release with free()); levels() is NULL after
+    int *releaseLevels();
+
+private:
+    friend class BfsEngine;
+    BfsResult();
+
+    int no_of_nodes;
+    int *h_levels;
+    int *h_parents;
+    BfsStats run_stats;
+};
+
+class BfsEngine
+{
+public:
+    explicit BfsEngine(const BfsOptions &options = BfsOptions());
+    BfsEngine(BfsEngine &&other) noexcept;
+    BfsEngine &operator=(BfsEngine &&other) noexcept;
+    ~BfsEngine();
+
+    BfsResult run(const Graph &graph, int source);
+
+    //--device fission: one engine per sub-device of the options' CPU device,
+    //--parts of them on disjoint cores (0: one per NUMA node), to run
+    //--independent queries side by side from one thread each
+    static std::vector<BfsEngine> split(const BfsOptions &options, int parts);
+
+    struct Impl;
+
+private:
+    explicit BfsEngine(std::unique_ptr<Impl> impl);
+
+    std::unique_ptr<Impl> impl;
+};
+
+} // namespace bfs
+
+#endif //_LIBBFS_
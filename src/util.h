@@ -1,6 +1,7 @@
 #ifndef _C_UTIL_
 #define _C_UTIL_
 #include <math.h>
+#include <stdlib.h>
 #include <iostream>
 #include <omp.h>
 //-------------------------------------------------------------------
@@ -14,6 +15,18 @@ void fill(datatype *A, const int n, const datatype maxi){
     }
 }
 
+//-------------------------------------------------------------------
+//--page aligned allocation, so OpenCL can use it in place
+//--(CL_MEM_USE_HOST_PTR). Release with free().
+//-------------------------------------------------------------------
+template<typename datatype>
+datatype *malloc_aligned(size_t n){
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 4096, n * sizeof(datatype) > 0 ? n * sizeof(datatype) : 1) != 0)
+        return NULL;
+    return (datatype *) ptr;
+}
+
 //--print matrix
 template<typename datatype>
 void print_matrix(datatype *A, int height, int width){
@@ -42,10 +55,10 @@ void verify_array(const datatype *cpuResults, const datatype *clResults, const i
       }
     }
     if (passed){
-        std::cout << "--cambine:passed:-)" << endl;
+        std::cout << "--cambine:passed:-)" << std::endl;
     }
     else{
-        std::cout << "--cambine: failed:-(" << endl;
+        std::cout << "--cambine: failed:-(" << std::endl;
     }
     return ;
 }
@@ -61,10 +74,10 @@ void compare_results(const datatype *cpuResults, const datatype *clResults, cons
       }
     }
     if (passed){
-        std::cout << "--cambine:passed:-)" << endl;
+        std::cout << "--cambine:passed:-)" << std::endl;
     }
     else{
-        std::cout << "--cambine: failed:-(" << endl;
+        std::cout << "--cambine: failed:-(" << std::endl;
     }
     return ;
 }